@@ -0,0 +1,259 @@
+#include <QtGui>
+#include "DiagramDocument.h"
+#include "DiagramScene.h"
+#include "Graph.h"
+#include "Node.h"
+#include "Link.h"
+
+DiagramWriter::DiagramWriter(QDataStream& out)
+  : out_(out)
+{
+}
+
+void DiagramWriter::write(const QList<Node*>& nodes, const QList<Link*>& links)
+{
+  QHash<Node*, quint32> indexes;
+  indexes.reserve(nodes.count());
+  for (int i = 0; i < nodes.count(); ++i)
+    indexes.insert(nodes[i], quint32(i));
+
+  QList<Link*> internalLinks;
+  foreach (Link* link, links)
+  {
+    if (indexes.contains(link->fromNode()) && indexes.contains(link->toNode()))
+      internalLinks.append(link);
+  }
+
+  out_ << quint32(nodes.count()) << quint32(internalLinks.count());
+
+  foreach (Node* node, nodes)
+  {
+    out_ << node->text()
+         << quint32(node->textColor().rgba())
+         << quint32(node->outlineColor().rgba())
+         << quint32(node->backgroundColor().rgba())
+         << double(node->x()) << double(node->y()) << double(node->zValue());
+  }
+
+  foreach (Link* link, internalLinks)
+  {
+    out_ << indexes.value(link->fromNode())
+         << indexes.value(link->toNode())
+         << quint32(link->color().rgba());
+  }
+}
+
+void DiagramWriter::write(const Graph& graph)
+{
+  QVector<quint32> indexes(graph.nodeCapacity());
+  quint32 count = 0;
+  for (int i = 0; i < graph.nodeCapacity(); ++i)
+  {
+    if (graph.hasNode(i))
+      indexes[i] = count++;
+  }
+
+  out_ << quint32(graph.nodeCount()) << quint32(graph.linkCount());
+
+  for (int i = 0; i < graph.nodeCapacity(); ++i)
+  {
+    if (!graph.hasNode(i))
+      continue;
+    QPointF pos = graph.position(i);
+    out_ << graph.text(i)
+         << quint32(graph.textColor(i))
+         << quint32(graph.outlineColor(i))
+         << quint32(graph.backgroundColor(i))
+         << double(pos.x()) << double(pos.y()) << double(graph.zValue(i));
+  }
+
+  for (int i = 0; i < graph.linkCapacity(); ++i)
+  {
+    if (graph.hasLink(i))
+    {
+      out_ << indexes[graph.fromNode(i)]
+           << indexes[graph.toNode(i)]
+           << quint32(graph.linkColor(i));
+    }
+  }
+}
+
+DiagramReader::DiagramReader(QDataStream& in, DiagramScene* scene)
+  : in_(in)
+{
+  scene_ = scene;
+  indexMethod_ = scene->itemIndexMethod();
+  indexSuspended_ = false;
+  error_ = false;
+  virtual_ = false;
+  nodeCount_ = 0;
+  linkCount_ = 0;
+  linksRead_ = 0;
+}
+
+DiagramReader::~DiagramReader()
+{
+  finish();
+}
+
+void DiagramReader::setOffset(const QPointF& offset)
+{
+  offset_ = offset;
+}
+
+void DiagramReader::setVirtual(bool virtualItems)
+{
+  virtual_ = virtualItems;
+}
+
+bool DiagramReader::readHeader()
+{
+  const quint64 MinNodeRecordSize = 40;
+  const quint64 LinkRecordSize = 12;
+
+  in_ >> nodeCount_ >> linkCount_;
+  if (in_.status() != QDataStream::Ok)
+  {
+    error_ = true;
+    return false;
+  }
+
+  QIODevice* device = in_.device();
+  if (device && !device->isSequential()
+      && nodeCount_ * MinNodeRecordSize + linkCount_ * LinkRecordSize
+         > quint64(device->bytesAvailable()))
+  {
+    error_ = true;
+    return false;
+  }
+
+  nodeIds_.reserve(nodeCount_);
+  if (!virtual_)
+  {
+    nodes_.reserve(nodeCount_);
+    links_.reserve(linkCount_);
+  }
+  scene_->graph().reserve(nodeCount_, linkCount_);
+
+  if (nodeCount_ + linkCount_ >= quint32(BulkThreshold)
+      && indexMethod_ != QGraphicsScene::NoIndex)
+  {
+    scene_->setItemIndexMethod(QGraphicsScene::NoIndex);
+    indexSuspended_ = true;
+  }
+  return true;
+}
+
+bool DiagramReader::readChunk()
+{
+  int budget = ChunkSize;
+
+  QString text;
+  quint32 textColor, outlineColor, backgroundColor;
+  double x, y, z;
+  Graph& graph = scene_->graph();
+  while (budget > 0 && quint32(nodeIds_.count()) < nodeCount_)
+  {
+    in_ >> text >> textColor >> outlineColor >> backgroundColor >> x >> y >> z;
+    if (in_.status() != QDataStream::Ok)
+    {
+      error_ = true;
+      return false;
+    }
+
+    if (virtual_)
+    {
+      int id = graph.addNode(0, QPointF(x + offset_.x(), y + offset_.y()));
+      graph.setText(id, text);
+      graph.setTextColor(id, textColor);
+      graph.setOutlineColor(id, outlineColor);
+      graph.setBackgroundColor(id, backgroundColor);
+      graph.setZValue(id, z);
+      scene_->nodeRecordAdded(id);
+      nodeIds_.append(id);
+    }
+    else
+    {
+      Node* node = new Node;
+      node->setText(text);
+      node->setTextColor(QColor::fromRgba(textColor));
+      node->setOutlineColor(QColor::fromRgba(outlineColor));
+      node->setBackgroundColor(QColor::fromRgba(backgroundColor));
+      node->setPos(x + offset_.x(), y + offset_.y());
+      node->setZValue(z);
+      scene_->addItem(node);
+      nodes_.append(node);
+      nodeIds_.append(node->id());
+    }
+    --budget;
+  }
+
+  quint32 from, to, color;
+  while (budget > 0 && quint32(linksRead_) < linkCount_)
+  {
+    in_ >> from >> to >> color;
+    if (in_.status() != QDataStream::Ok
+        || from >= quint32(nodeIds_.count()) || to >= quint32(nodeIds_.count()))
+    {
+      error_ = true;
+      return false;
+    }
+
+    if (virtual_)
+    {
+      int id = graph.addLink(nodeIds_[from], nodeIds_[to], 0);
+      graph.setLinkColor(id, color);
+      scene_->linkRecordAdded(id);
+    }
+    else
+    {
+      Link* link = new Link(nodes_[from], nodes_[to]);
+      link->setColor(QColor::fromRgba(color));
+      scene_->addItem(link);
+      links_.append(link);
+    }
+    ++linksRead_;
+    --budget;
+  }
+  return true;
+}
+
+void DiagramReader::finish()
+{
+  if (indexSuspended_)
+  {
+    scene_->setItemIndexMethod(indexMethod_);
+    indexSuspended_ = false;
+  }
+}
+
+bool DiagramReader::atEnd() const
+{
+  return error_ || (quint32(nodeIds_.count()) == nodeCount_
+                    && quint32(linksRead_) == linkCount_);
+}
+
+bool DiagramReader::hasError() const
+{
+  return error_;
+}
+
+int DiagramReader::itemCount() const
+{
+  return int(nodeCount_ + linkCount_);
+}
+
+int DiagramReader::itemsRead() const
+{
+  return nodeIds_.count() + linksRead_;
+}
+
+const QVector<Node*>& DiagramReader::nodes() const
+{
+  return nodes_;
+}
+
+const QVector<Link*>& DiagramReader::links() const
+{
+  return links_;
+}
@@ -0,0 +1,73 @@
+#ifndef DIAGRAMDOCUMENT_H
+#define DIAGRAMDOCUMENT_H
+
+#include <QGraphicsScene>
+#include <QList>
+#include <QPointF>
+#include <QVector>
+
+class Node;
+class Link;
+class Graph;
+class DiagramScene;
+class QDataStream;
+
+enum { DiagramMagicNumber = 0x4D1A6E4B };
+
+// Node records are written first, links refer to them by their index in
+// the node list, so the whole document can be recreated in a single pass.
+class DiagramWriter
+{
+public:
+  DiagramWriter(QDataStream& out);
+  void write(const QList<Node*>& nodes, const QList<Link*>& links);
+  void write(const Graph& graph);
+
+private:
+  QDataStream& out_;
+};
+
+// Reads a document in chunks of ChunkSize records so the caller can keep
+// the user interface alive between chunks. While a large document is being
+// read the scene index is switched off and rebuilt once in finish(). With
+// setVirtual() the records go into the graph without scene items and the
+// scene decides which of them to show.
+class DiagramReader
+{
+public:
+  enum { ChunkSize = 4096, BulkThreshold = 1000 };
+
+  DiagramReader(QDataStream& in, DiagramScene* scene);
+  ~DiagramReader();
+
+  void setOffset(const QPointF& offset);
+  void setVirtual(bool virtualItems);
+  bool readHeader();
+  bool readChunk();
+  void finish();
+
+  bool atEnd() const;
+  bool hasError() const;
+  int itemCount() const;
+  int itemsRead() const;
+  // The items created, which are none for a virtual read.
+  const QVector<Node*>& nodes() const;
+  const QVector<Link*>& links() const;
+
+private:
+  QDataStream& in_;
+  DiagramScene* scene_;
+  QGraphicsScene::ItemIndexMethod indexMethod_;
+  bool indexSuspended_;
+  bool error_;
+  bool virtual_;
+  QPointF offset_;
+  quint32 nodeCount_;
+  quint32 linkCount_;
+  QVector<int> nodeIds_;
+  int linksRead_;
+  QVector<Node*> nodes_;
+  QVector<Link*> links_;
+};
+
+#endif
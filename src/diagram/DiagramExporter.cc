@@ -0,0 +1,314 @@
+#include <QtGui>
+#include <QtSvg>
+#include "DiagramExporter.h"
+#include "DiagramScene.h"
+#include "Graph.h"
+#include "Node.h"
+#include "Link.h"
+
+static const char* const TileKeyText = "DiagramTileKey";
+
+static bool zLessThan(const QGraphicsItem* item1, const QGraphicsItem* item2)
+{
+  return item1->zValue() < item2->zValue();
+}
+
+class DiagramExporter::TileJob : public QRunnable
+{
+public:
+  TileJob(const DiagramExporter* exporter, const Tile* tile, const QString& fileName,
+          QAtomicInt* failed, QAtomicInt* reused)
+    : exporter_(exporter), tile_(tile), fileName_(fileName), failed_(failed), reused_(reused)
+  {
+  }
+
+  void run()
+  {
+    bool reused;
+    if (!exporter_->renderTile(*tile_, fileName_, &reused))
+      failed_->ref();
+    else if (reused)
+      reused_->ref();
+  }
+
+private:
+  const DiagramExporter* exporter_;
+  const Tile* tile_;
+  QString fileName_;
+  QAtomicInt* failed_;
+  QAtomicInt* reused_;
+};
+
+DiagramExporter::DiagramExporter(DiagramScene* scene)
+{
+  scene_ = scene;
+  scale_ = 1.0;
+  tileSize_ = 2048;
+  threadCount_ = QThread::idealThreadCount();
+  tilesRendered_ = 0;
+  tilesReused_ = 0;
+}
+
+void DiagramExporter::setScale(qreal scale)
+{
+  scale_ = scale;
+}
+
+void DiagramExporter::setTileSize(int size)
+{
+  tileSize_ = size;
+}
+
+void DiagramExporter::setThreadCount(int count)
+{
+  threadCount_ = qMax(1, count);
+}
+
+int DiagramExporter::tilesRendered() const
+{
+  return tilesRendered_;
+}
+
+int DiagramExporter::tilesReused() const
+{
+  return tilesReused_;
+}
+
+QString DiagramExporter::errorString() const
+{
+  return errorString_;
+}
+
+bool DiagramExporter::exportTiles(const QString& fileName)
+{
+  buildIndex();
+
+  QAtomicInt failed(0);
+  QAtomicInt reused(0);
+
+  // Text can only be laid out off the GUI thread when the font backend
+  // allows it; otherwise the tiles are painted one after another here.
+  if (threadCount_ > 1 && QFontDatabase::supportsThreadedFontRendering())
+  {
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount_);
+    for (int i = 0; i < tiles_.count(); ++i)
+      pool.start(new TileJob(this, tiles_.constData() + i, fileName, &failed, &reused));
+    pool.waitForDone();
+  }
+  else
+  {
+    for (int i = 0; i < tiles_.count(); ++i)
+      TileJob(this, tiles_.constData() + i, fileName, &failed, &reused).run();
+  }
+
+  tilesReused_ = reused;
+  tilesRendered_ = tiles_.count() - reused - failed;
+  if (failed > 0)
+  {
+    errorString_ = QString("Cannot write %1 of %2 tiles for %3.")
+                   .arg(int(failed)).arg(tiles_.count()).arg(fileName);
+    return false;
+  }
+  return true;
+}
+
+bool DiagramExporter::exportSvg(const QString& fileName)
+{
+  buildIndex();
+
+  QSize size = (bounds_.size() * scale_).toSize();
+  QSvgGenerator generator;
+  generator.setFileName(fileName);
+  generator.setSize(size);
+  generator.setViewBox(QRect(QPoint(0, 0), size));
+
+  QPainter painter;
+  if (!painter.begin(&generator))
+  {
+    errorString_ = QString("Cannot write file %1.").arg(fileName);
+    return false;
+  }
+  painter.scale(scale_, scale_);
+  painter.translate(-bounds_.topLeft());
+
+  QVector<int> entries(entries_.count());
+  for (int i = 0; i < entries.count(); ++i)
+    entries[i] = i;
+  paintEntries(&painter, entries);
+  painter.end();
+  return true;
+}
+
+bool DiagramExporter::exportPdf(const QString& fileName)
+{
+  buildIndex();
+
+  QPrinter printer(QPrinter::HighResolution);
+  printer.setOutputFormat(QPrinter::PdfFormat);
+  printer.setOutputFileName(fileName);
+  printer.setFullPage(true);
+  printer.setPaperSize(bounds_.size() * scale_, QPrinter::Point);
+
+  QPainter painter;
+  if (!painter.begin(&printer))
+  {
+    errorString_ = QString("Cannot write file %1.").arg(fileName);
+    return false;
+  }
+
+  QRect page = printer.pageRect();
+  qreal factor = qMin(page.width() / bounds_.width(), page.height() / bounds_.height());
+  painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+  painter.scale(factor, factor);
+  painter.translate(-bounds_.topLeft());
+
+  QVector<int> entries(entries_.count());
+  for (int i = 0; i < entries.count(); ++i)
+    entries[i] = i;
+  paintEntries(&painter, entries);
+  painter.end();
+  return true;
+}
+
+// Collects every item in stacking order together with the geometry the
+// painters need, and buckets the items into the tiles they overlap. The
+// buckets are the shared spatial index: each tile paints only its own.
+void DiagramExporter::buildIndex()
+{
+  const Graph& graph = scene_->graph();
+  QList<QGraphicsItem*> items;
+  for (int i = 0; i < graph.linkCapacity(); ++i)
+  {
+    if (graph.link(i))
+      items.append(graph.link(i));
+  }
+  for (int i = 0; i < graph.nodeCapacity(); ++i)
+  {
+    if (graph.node(i))
+      items.append(graph.node(i));
+  }
+  qStableSort(items.begin(), items.end(), zLessThan);
+
+  entries_.resize(items.count());
+  bounds_ = QRectF();
+  for (int i = 0; i < items.count(); ++i)
+  {
+    Entry& entry = entries_[i];
+    entry.item = items[i];
+    entry.boundingRect = items[i]->boundingRect();
+    entry.transform = items[i]->sceneTransform();
+    entry.sceneRect = entry.transform.mapRect(entry.boundingRect);
+    bounds_ |= entry.sceneRect;
+  }
+  if (bounds_.isEmpty())
+    bounds_ = scene_->sceneRect();
+  bounds_.adjust(-8, -8, +8, +8);
+
+  const qreal extent = tileSize_ / scale_;
+  const int columns = qMax(1, qCeil(bounds_.width() / extent));
+  const int rows = qMax(1, qCeil(bounds_.height() / extent));
+
+  tiles_.clear();
+  tiles_.resize(rows * columns);
+  for (int row = 0; row < rows; ++row)
+  {
+    for (int column = 0; column < columns; ++column)
+    {
+      Tile& tile = tiles_[row * columns + column];
+      tile.row = row;
+      tile.column = column;
+      tile.rect = QRectF(bounds_.left() + column * extent, bounds_.top() + row * extent,
+                         extent, extent);
+    }
+  }
+
+  for (int i = 0; i < entries_.count(); ++i)
+  {
+    const QRectF& rect = entries_[i].sceneRect;
+    int left = qBound(0, int((rect.left() - bounds_.left()) / extent), columns - 1);
+    int right = qBound(0, int((rect.right() - bounds_.left()) / extent), columns - 1);
+    int top = qBound(0, int((rect.top() - bounds_.top()) / extent), rows - 1);
+    int bottom = qBound(0, int((rect.bottom() - bounds_.top()) / extent), rows - 1);
+    for (int row = top; row <= bottom; ++row)
+    {
+      for (int column = left; column <= right; ++column)
+        tiles_[row * columns + column].entries.append(i);
+    }
+  }
+}
+
+void DiagramExporter::paintEntries(QPainter* painter, const QVector<int>& entries) const
+{
+  QStyleOptionGraphicsItem option;
+  foreach (int i, entries)
+  {
+    const Entry& entry = entries_[i];
+    option.exposedRect = entry.boundingRect;
+    painter->save();
+    painter->setTransform(entry.transform, true);
+    entry.item->paint(painter, &option, 0);
+    painter->restore();
+  }
+}
+
+QString DiagramExporter::tileKey(const Tile& tile) const
+{
+  QByteArray data;
+  QDataStream out(&data, QIODevice::WriteOnly);
+  out << tile.rect << double(scale_) << qint32(tileSize_);
+
+  foreach (int i, tile.entries)
+  {
+    const QGraphicsItem* item = entries_[i].item;
+    const Node* node = dynamic_cast<const Node*>(item);
+    const Link* link = dynamic_cast<const Link*>(item);
+    if (node)
+    {
+      out << quint8(0) << node->text()
+          << quint32(node->textColor().rgba())
+          << quint32(node->outlineColor().rgba())
+          << quint32(node->backgroundColor().rgba())
+          << entries_[i].sceneRect;
+    }
+    else if (link)
+    {
+      out << quint8(1) << link->line() << quint32(link->color().rgba());
+    }
+  }
+  return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+}
+
+QString DiagramExporter::tileFileName(const QString& fileName, const Tile& tile) const
+{
+  QFileInfo info(fileName);
+  return info.dir().filePath(QString("%1_%2_%3.png")
+                             .arg(info.completeBaseName())
+                             .arg(tile.row).arg(tile.column));
+}
+
+bool DiagramExporter::renderTile(const Tile& tile, const QString& fileName, bool* reused) const
+{
+  QString key = tileKey(tile);
+  QString tileName = tileFileName(fileName, tile);
+
+  QImageReader reader(tileName);
+  if (reader.canRead() && reader.text(TileKeyText) == key)
+  {
+    *reused = true;
+    return true;
+  }
+  *reused = false;
+
+  QImage image(tileSize_, tileSize_, QImage::Format_ARGB32_Premultiplied);
+  image.fill(qRgb(255, 255, 255));
+  {
+    QPainter painter(&image);
+    painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+    painter.scale(scale_, scale_);
+    painter.translate(-tile.rect.topLeft());
+    paintEntries(&painter, tile.entries);
+  }
+  image.setText(TileKeyText, key);
+  return image.save(tileName, "PNG");
+}
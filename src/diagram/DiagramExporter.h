@@ -0,0 +1,70 @@
+#ifndef DIAGRAMEXPORTER_H
+#define DIAGRAMEXPORTER_H
+
+#include <QRectF>
+#include <QString>
+#include <QTransform>
+#include <QVector>
+
+class DiagramScene;
+class QGraphicsItem;
+class QPainter;
+
+// Renders a diagram without a view or an OpenGL context. Tiled PNG output
+// is painted in parallel on per-thread QImages; every tile records a key of
+// its contents so that unchanged tiles from an earlier run are left alone.
+class DiagramExporter
+{
+public:
+  DiagramExporter(DiagramScene* scene);
+
+  void setScale(qreal scale);
+  void setTileSize(int size);
+  void setThreadCount(int count);
+
+  bool exportTiles(const QString& fileName);
+  bool exportSvg(const QString& fileName);
+  bool exportPdf(const QString& fileName);
+
+  int tilesRendered() const;
+  int tilesReused() const;
+  QString errorString() const;
+
+private:
+  struct Entry
+  {
+    QGraphicsItem* item;
+    QRectF boundingRect;
+    QTransform transform;
+    QRectF sceneRect;
+  };
+
+  struct Tile
+  {
+    int row;
+    int column;
+    QRectF rect;
+    QVector<int> entries;
+  };
+
+  class TileJob;
+
+  void buildIndex();
+  void paintEntries(QPainter* painter, const QVector<int>& entries) const;
+  QString tileKey(const Tile& tile) const;
+  QString tileFileName(const QString& fileName, const Tile& tile) const;
+  bool renderTile(const Tile& tile, const QString& fileName, bool* reused) const;
+
+  DiagramScene* scene_;
+  qreal scale_;
+  int tileSize_;
+  int threadCount_;
+  QRectF bounds_;
+  QVector<Entry> entries_;
+  QVector<Tile> tiles_;
+  int tilesRendered_;
+  int tilesReused_;
+  QString errorString_;
+};
+
+#endif
@@ -0,0 +1,531 @@
+#include <QtGui>
+#include "DiagramScene.h"
+#include "Node.h"
+#include "Link.h"
+
+static qint64 cellKey(int column, int row)
+{
+  return (qint64(column) << 32) | quint32(row);
+}
+
+static qint64 cellKey(const QPointF& pos)
+{
+  return cellKey(qFloor(pos.x() / DiagramScene::CellSize), qFloor(pos.y() / DiagramScene::CellSize));
+}
+
+static bool crosses(const QLineF& line, const QRectF& rect)
+{
+  if (rect.contains(line.p1()) || rect.contains(line.p2()))
+    return true;
+  QLineF edges[4] = { QLineF(rect.topLeft(), rect.topRight()), QLineF(rect.topRight(), rect.bottomRight()),
+                      QLineF(rect.bottomRight(), rect.bottomLeft()), QLineF(rect.bottomLeft(), rect.topLeft()) };
+  QPointF point;
+  for (int i = 0; i < 4; ++i)
+  {
+    if (line.intersect(edges[i], &point) == QLineF::BoundedIntersection)
+      return true;
+  }
+  return false;
+}
+
+DiagramScene::DiagramScene(qreal x, qreal y, qreal width, qreal height, QObject* parent)
+  : QGraphicsScene(x, y, width, height, parent), stackingOrder_(&graph_)
+{
+  virtualized_ = false;
+}
+
+DiagramScene::~DiagramScene()
+{
+  // The items reach back into graph_, so they must go before it does.
+  clear();
+  qDeleteAll(spareNodes_);
+  qDeleteAll(spareLinks_);
+}
+
+Graph& DiagramScene::graph()
+{
+  return graph_;
+}
+
+const Graph& DiagramScene::graph() const
+{
+  return graph_;
+}
+
+StackingOrder& DiagramScene::stackingOrder()
+{
+  return stackingOrder_;
+}
+
+// Removes every item and record. Nothing survives, so the scene drops its
+// index and item lists wholesale instead of unlinking every item on its own.
+void DiagramScene::clearDiagram()
+{
+  for (int i = 0; i < graph_.nodeCapacity(); ++i)
+  {
+    if (graph_.node(i))
+      graph_.node(i)->graph_ = 0;
+  }
+  for (int i = 0; i < graph_.linkCapacity(); ++i)
+  {
+    if (graph_.link(i))
+      graph_.link(i)->graph_ = 0;
+  }
+  graph_.clear();
+  cells_.clear();
+  linkCells_.clear();
+  clear();
+}
+
+// Deletes the nodes and links together with every link attached to the
+// nodes. The items are deselected under a single selectionChanged(), the
+// graph is updated in one batch, and the items are detached from it before
+// they are freed so their destructors do no further bookkeeping.
+void DiagramScene::deleteItems(const QList<Node*>& nodes, const QList<Link*>& links)
+{
+  QSet<Link*> doomedLinks = links.toSet();
+  QSet<int> doomedRecords;
+  foreach (Node* node, nodes)
+  {
+    const Graph::LinkList& ids = graph_.links(node->id());
+    for (int i = 0; i < ids.count(); ++i)
+    {
+      if (graph_.link(ids[i]))
+        doomedLinks.insert(graph_.link(ids[i]));
+      else
+        doomedRecords.insert(ids[i]);
+    }
+  }
+
+  int selectedCount = selectedNodes_.count() + selectedLinks_.count();
+  blockSignals(true);
+  foreach (Node* node, nodes)
+    node->setSelected(false);
+  foreach (Link* link, doomedLinks)
+    link->setSelected(false);
+  blockSignals(false);
+  bool selectionShrunk = (selectedNodes_.count() + selectedLinks_.count() != selectedCount);
+
+  if (nodes.count() == graph_.nodeCount())
+    clearDiagram();
+  else
+  {
+    QVector<int> nodeIds;
+    nodeIds.reserve(nodes.count());
+    foreach (Node* node, nodes)
+    {
+      nodeIds.append(node->id());
+      node->graph_ = 0;
+    }
+
+    QVector<int> linkIds;
+    linkIds.reserve(doomedLinks.count() + doomedRecords.count());
+    foreach (int id, doomedRecords)
+      linkIds.append(id);
+    foreach (Link* link, doomedLinks)
+    {
+      linkIds.append(link->id());
+      link->graph_ = 0;
+    }
+
+    graph_.removeItems(nodeIds, linkIds);
+
+    qDeleteAll(doomedLinks);
+    qDeleteAll(nodes);
+  }
+
+  if (selectionShrunk)
+    emit selectionChanged();
+}
+
+void DiagramScene::deleteSelection()
+{
+  if (hasSelection())
+    deleteItems(selectedNodes(), selectedLinks());
+}
+
+// Replaces the selection with the given items and emits selectionChanged()
+// once for the whole change.
+void DiagramScene::setSelection(const QList<Node*>& nodes, const QList<Link*>& links)
+{
+  blockSignals(true);
+  clearSelection();
+  foreach (Node* node, nodes)
+    node->setSelected(true);
+  foreach (Link* link, links)
+    link->setSelected(true);
+  blockSignals(false);
+  emit selectionChanged();
+}
+
+bool DiagramScene::hasSelection() const
+{
+  return !selectedNodes_.isEmpty() || !selectedLinks_.isEmpty();
+}
+
+int DiagramScene::selectedNodeCount() const
+{
+  return selectedNodes_.count();
+}
+
+int DiagramScene::selectedLinkCount() const
+{
+  return selectedLinks_.count();
+}
+
+Node* DiagramScene::selectedNode() const
+{
+  if (selectedNodes_.count() == 1 && selectedLinks_.isEmpty())
+    return *selectedNodes_.constBegin();
+  return 0;
+}
+
+Link* DiagramScene::selectedLink() const
+{
+  if (selectedLinks_.count() == 1 && selectedNodes_.isEmpty())
+    return *selectedLinks_.constBegin();
+  return 0;
+}
+
+QList<Node*> DiagramScene::selectedNodes() const
+{
+  return selectedNodes_.toList();
+}
+
+QList<Link*> DiagramScene::selectedLinks() const
+{
+  return selectedLinks_.toList();
+}
+
+void DiagramScene::nodeSelectionChanged(Node* node, bool selected)
+{
+  if (selected)
+    selectedNodes_.insert(node);
+  else
+    selectedNodes_.remove(node);
+}
+
+void DiagramScene::linkSelectionChanged(Link* link, bool selected)
+{
+  if (selected)
+    selectedLinks_.insert(link);
+  else
+    selectedLinks_.remove(link);
+}
+
+void DiagramScene::setVirtualized(bool virtualized)
+{
+  if (virtualized == virtualized_)
+    return;
+
+  virtualized_ = virtualized;
+  if (virtualized_)
+  {
+    // Items outside the region are released on the next setVisibleRegion().
+    for (int i = 0; i < graph_.nodeCapacity(); ++i)
+    {
+      if (graph_.hasNode(i) && !graph_.node(i))
+        cells_[cellKey(graph_.position(i))].append(i);
+    }
+    for (int i = 0; i < graph_.linkCapacity(); ++i)
+    {
+      if (graph_.hasLink(i) && !graph_.link(i))
+        fileLink(i);
+    }
+  }
+  else
+  {
+    cells_.clear();
+    linkCells_.clear();
+    for (int i = 0; i < graph_.nodeCapacity(); ++i)
+    {
+      if (graph_.hasNode(i) && !graph_.node(i))
+        materializeNode(i);
+    }
+    for (int i = 0; i < graph_.linkCapacity(); ++i)
+    {
+      if (graph_.hasLink(i) && !graph_.link(i))
+        materializeLink(i);
+    }
+  }
+}
+
+bool DiagramScene::isVirtualized() const
+{
+  return virtualized_;
+}
+
+// Gives items to the nodes inside rect, to every link touching them and
+// to every link crossing rect, and takes them back from everything else
+// that is not selected or being dragged. Only the cells overlapping rect
+// and the current items are visited, so the cost follows the size of the
+// region, not of the diagram.
+void DiagramScene::setVisibleRegion(const QRectF& rect)
+{
+  if (!virtualized_)
+    return;
+
+  QSet<int> keptNodes;
+  QList<Node*> releasedNodes;
+  QList<Link*> currentLinks;
+  foreach (QGraphicsItem* item, items())
+  {
+    Node* node = dynamic_cast<Node*>(item);
+    if (node)
+    {
+      if (rect.contains(node->pos()) || node->isSelected() || node == mouseGrabberItem())
+        keptNodes.insert(node->id());
+      else
+        releasedNodes.append(node);
+    }
+    else
+    {
+      Link* link = dynamic_cast<Link*>(item);
+      if (link)
+        currentLinks.append(link);
+    }
+  }
+
+  foreach (Node* node, releasedNodes)
+    releaseNode(node);
+
+  foreach (int id, takeNodeRecords(rect))
+  {
+    materializeNode(id);
+    keptNodes.insert(id);
+  }
+
+  QSet<int> keptLinks;
+  foreach (int id, keptNodes)
+  {
+    const Graph::LinkList& ids = graph_.links(id);
+    for (int i = 0; i < ids.count(); ++i)
+      keptLinks.insert(ids[i]);
+  }
+  foreach (Link* link, currentLinks)
+  {
+    if (!keptLinks.contains(link->id()) && !link->isSelected() && !crosses(link->line(), rect))
+      releaseLink(link);
+  }
+  foreach (int id, takeLinkRecords(rect))
+    keptLinks.insert(id);
+  foreach (int id, keptLinks)
+  {
+    if (!graph_.link(id))
+      materializeLink(id);
+  }
+}
+
+// Files a node record that has no item under the cell of its position.
+void DiagramScene::nodeRecordAdded(int node)
+{
+  if (virtualized_)
+    cells_[cellKey(graph_.position(node))].append(node);
+  else
+    materializeNode(node);
+}
+
+void DiagramScene::linkRecordAdded(int link)
+{
+  if (virtualized_)
+    fileLink(link);
+  else
+    materializeLink(link);
+}
+
+QRectF DiagramScene::diagramBounds() const
+{
+  const qreal Margin = 100;
+
+  QRectF bounds = itemsBoundingRect();
+  if (virtualized_)
+  {
+    QPolygonF positions;
+    for (int i = 0; i < graph_.nodeCapacity(); ++i)
+    {
+      if (graph_.hasNode(i) && !graph_.node(i))
+        positions.append(graph_.position(i));
+    }
+    if (!positions.isEmpty())
+      bounds |= positions.boundingRect().adjusted(-Margin, -Margin, +Margin, +Margin);
+  }
+  return bounds;
+}
+
+void DiagramScene::materializeNode(int node)
+{
+  Node* item = spareNodes_.isEmpty() ? new Node : spareNodes_.takeLast();
+  item->attach(&graph_, node);
+  addItem(item);
+}
+
+void DiagramScene::materializeLink(int link)
+{
+  Link* item = spareLinks_.isEmpty() ? new Link : spareLinks_.takeLast();
+  item->attach(&graph_, link);
+  addItem(item);
+}
+
+void DiagramScene::releaseNode(Node* node)
+{
+  int id = node->id();
+  removeItem(node);
+  node->detach();
+  cells_[cellKey(graph_.position(id))].append(id);
+
+  if (spareNodes_.count() < SpareItemLimit)
+    spareNodes_.append(node);
+  else
+    delete node;
+}
+
+void DiagramScene::releaseLink(Link* link)
+{
+  int id = link->id();
+  removeItem(link);
+  link->detach();
+  fileLink(id);
+
+  if (spareLinks_.count() < SpareItemLimit)
+    spareLinks_.append(link);
+  else
+    delete link;
+}
+
+// Removes and returns the records inside rect from the cells. Records of
+// nodes that were deleted in the meantime are dropped on the way.
+QVector<int> DiagramScene::takeNodeRecords(const QRectF& rect)
+{
+  QVector<int> taken;
+  int left = qFloor(rect.left() / CellSize);
+  int right = qFloor(rect.right() / CellSize);
+  int top = qFloor(rect.top() / CellSize);
+  int bottom = qFloor(rect.bottom() / CellSize);
+
+  for (int column = left; column <= right; ++column)
+  {
+    for (int row = top; row <= bottom; ++row)
+    {
+      QHash<qint64, QVector<int> >::iterator cell = cells_.find(cellKey(column, row));
+      if (cell == cells_.end())
+        continue;
+
+      QVector<int>& ids = cell.value();
+      for (int i = 0; i < ids.count(); )
+      {
+        int id = ids[i];
+        bool stale = !graph_.hasNode(id) || graph_.node(id);
+        if (stale || rect.contains(graph_.position(id)))
+        {
+          if (!stale)
+            taken.append(id);
+          ids[i] = ids.last();
+          ids.pop_back();
+        }
+        else
+          ++i;
+      }
+      if (ids.isEmpty())
+        cells_.erase(cell);
+    }
+  }
+  return taken;
+}
+
+QLineF DiagramScene::linkLine(int link) const
+{
+  return QLineF(graph_.position(graph_.fromNode(link)), graph_.position(graph_.toNode(link)));
+}
+
+// The cells of points every half cell along the link. A line may clip the
+// corner of a cell between two points, so lookups also search the cells
+// next to the region.
+QVector<qint64> DiagramScene::linkCellKeys(int link) const
+{
+  QLineF line = linkLine(link);
+  int steps = qMax(1, qCeil(line.length() / (CellSize / 2)));
+  QVector<qint64> keys;
+  for (int i = 0; i <= steps; ++i)
+  {
+    qint64 key = cellKey(line.pointAt(qreal(i) / steps));
+    if (keys.isEmpty() || keys.last() != key)
+      keys.append(key);
+  }
+  return keys;
+}
+
+// A link without an item cannot move: both its nodes are without items too,
+// or it would have been kept with them.
+void DiagramScene::fileLink(int link)
+{
+  foreach (qint64 key, linkCellKeys(link))
+    linkCells_[key].append(link);
+}
+
+// Removes and returns the link records whose lines cross rect. Records of
+// links that were deleted or given items in the meantime are dropped on
+// the way.
+QVector<int> DiagramScene::takeLinkRecords(const QRectF& rect)
+{
+  QSet<int> crossing;
+  int left = qFloor(rect.left() / CellSize) - 1;
+  int right = qFloor(rect.right() / CellSize) + 1;
+  int top = qFloor(rect.top() / CellSize) - 1;
+  int bottom = qFloor(rect.bottom() / CellSize) + 1;
+
+  for (int column = left; column <= right; ++column)
+  {
+    for (int row = top; row <= bottom; ++row)
+    {
+      QHash<qint64, QVector<int> >::iterator cell = linkCells_.find(cellKey(column, row));
+      if (cell == linkCells_.end())
+        continue;
+
+      QVector<int>& ids = cell.value();
+      for (int i = 0; i < ids.count(); )
+      {
+        int id = ids[i];
+        if (!graph_.hasLink(id) || graph_.link(id))
+        {
+          ids[i] = ids.last();
+          ids.pop_back();
+          continue;
+        }
+        if (crosses(linkLine(id), rect))
+          crossing.insert(id);
+        ++i;
+      }
+      if (ids.isEmpty())
+        linkCells_.erase(cell);
+    }
+  }
+
+  QVector<int> taken;
+  foreach (int id, crossing)
+  {
+    foreach (qint64 key, linkCellKeys(id))
+    {
+      QHash<qint64, QVector<int> >::iterator cell = linkCells_.find(key);
+      if (cell == linkCells_.end())
+        continue;
+      QVector<int>& ids = cell.value();
+      int i = ids.indexOf(id);
+      if (i >= 0)
+      {
+        ids[i] = ids.last();
+        ids.pop_back();
+      }
+      if (ids.isEmpty())
+        linkCells_.erase(cell);
+    }
+    taken.append(id);
+  }
+  return taken;
+}
+
+// Called for changes the user makes to the diagram itself, as opposed to
+// the items a virtualized scene creates and recycles while panning.
+void DiagramScene::markModified()
+{
+  emit modified();
+}
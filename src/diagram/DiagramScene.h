@@ -0,0 +1,83 @@
+#ifndef DIAGRAMSCENE_H
+#define DIAGRAMSCENE_H
+
+#include <QGraphicsScene>
+#include <QHash>
+#include <QSet>
+#include "Graph.h"
+#include "StackingOrder.h"
+
+class Node;
+class Link;
+
+// A scene whose diagram lives in a Graph. In virtualized mode only the
+// nodes inside the visible region, plus those that are selected, have
+// scene items; the rest are plain graph records kept in a coarse grid of
+// cells, and items are recycled as the region moves. Links without items
+// are kept in a second grid, under every cell their line passes through,
+// so a long link crossing the region is shown even when neither of its
+// nodes is.
+class DiagramScene : public QGraphicsScene
+{
+  Q_OBJECT
+
+public:
+  enum { CellSize = 512, SpareItemLimit = 512 };
+
+  DiagramScene(qreal x, qreal y, qreal width, qreal height, QObject* parent = 0);
+  ~DiagramScene();
+
+  Graph& graph();
+  const Graph& graph() const;
+  StackingOrder& stackingOrder();
+
+  void clearDiagram();
+  void deleteItems(const QList<Node*>& nodes, const QList<Link*>& links);
+  void deleteSelection();
+  void setSelection(const QList<Node*>& nodes, const QList<Link*>& links);
+
+  bool hasSelection() const;
+  int selectedNodeCount() const;
+  int selectedLinkCount() const;
+  Node* selectedNode() const;
+  Link* selectedLink() const;
+  QList<Node*> selectedNodes() const;
+  QList<Link*> selectedLinks() const;
+
+  void nodeSelectionChanged(Node* node, bool selected);
+  void linkSelectionChanged(Link* link, bool selected);
+
+  void setVirtualized(bool virtualized);
+  bool isVirtualized() const;
+  void setVisibleRegion(const QRectF& rect);
+  void nodeRecordAdded(int node);
+  void linkRecordAdded(int link);
+  QRectF diagramBounds() const;
+  void markModified();
+
+signals:
+  void modified();
+
+private:
+  void materializeNode(int node);
+  void materializeLink(int link);
+  void releaseNode(Node* node);
+  void releaseLink(Link* link);
+  QVector<int> takeNodeRecords(const QRectF& rect);
+  QLineF linkLine(int link) const;
+  QVector<qint64> linkCellKeys(int link) const;
+  void fileLink(int link);
+  QVector<int> takeLinkRecords(const QRectF& rect);
+
+  Graph graph_;
+  StackingOrder stackingOrder_;
+  bool virtualized_;
+  QHash<qint64, QVector<int> > cells_;
+  QHash<qint64, QVector<int> > linkCells_;
+  QList<Node*> spareNodes_;
+  QList<Link*> spareLinks_;
+  QSet<Node*> selectedNodes_;
+  QSet<Link*> selectedLinks_;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include <QtGui>
+#include "DiagramView.h"
+#include "DiagramScene.h"
+#include "RenderStats.h"
+
+DiagramView::DiagramView(QWidget* parent)
+  : QGraphicsView(parent)
+{
+  showFrameStats_ = false;
+  savedUpdateMode_ = viewportUpdateMode();
+  frameTime_ = 0;
+  nodesPainted_ = 0;
+  linksPainted_ = 0;
+  indexUpdates_ = 0;
+}
+
+bool DiagramView::showsFrameStats() const
+{
+  return showFrameStats_;
+}
+
+void DiagramView::setShowFrameStats(bool show)
+{
+  if (show == showFrameStats_)
+    return;
+
+  // The overlay is drawn in viewport coordinates, so every frame has to
+  // repaint the whole viewport for it to stay current.
+  showFrameStats_ = show;
+  if (show)
+  {
+    savedUpdateMode_ = viewportUpdateMode();
+    setViewportUpdateMode(FullViewportUpdate);
+  }
+  else
+    setViewportUpdateMode(savedUpdateMode_);
+  viewport()->update();
+}
+
+// Tells a virtualized scene what is on screen, with half a viewport of
+// margin on every side so that short pans find their items already there.
+void DiagramView::updateVisibleRegion()
+{
+  materialized_ = QRectF();
+  DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+  if (!diagram || !diagram->isVirtualized())
+    return;
+
+  QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+  qreal dx = visible.width() / 2;
+  qreal dy = visible.height() / 2;
+  materialized_ = visible.adjusted(-dx, -dy, +dx, +dy);
+  diagram->setVisibleRegion(materialized_);
+}
+
+// Scrolling within the margin of the last region finds every item it
+// needs already there, so the scene is only told again once the viewport
+// reaches past it.
+void DiagramView::followViewport()
+{
+  QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+  if (materialized_.isNull() || !materialized_.contains(visible))
+    updateVisibleRegion();
+}
+
+void DiagramView::resizeEvent(QResizeEvent* event)
+{
+  QGraphicsView::resizeEvent(event);
+  followViewport();
+}
+
+void DiagramView::scrollContentsBy(int dx, int dy)
+{
+  QGraphicsView::scrollContentsBy(dx, dy);
+  followViewport();
+}
+
+void DiagramView::paintEvent(QPaintEvent* event)
+{
+  if (!showFrameStats_)
+  {
+    QGraphicsView::paintEvent(event);
+    return;
+  }
+
+  indexUpdates_ = RenderStats::takeIndexUpdates();
+  RenderStats::takeNodesPainted();
+  RenderStats::takeLinksPainted();
+
+  QElapsedTimer timer;
+  timer.start();
+  QGraphicsView::paintEvent(event);
+
+  // In milliseconds with the fraction kept, smoothed over the last few
+  // frames so the number is readable.
+  frameTime_ = 0.8 * frameTime_ + 0.2 * (timer.nsecsElapsed() / 1e6);
+}
+
+void DiagramView::drawForeground(QPainter* painter, const QRectF& rect)
+{
+  QGraphicsView::drawForeground(painter, rect);
+  if (!showFrameStats_)
+    return;
+
+  nodesPainted_ = RenderStats::takeNodesPainted();
+  linksPainted_ = RenderStats::takeLinksPainted();
+
+  QString text = tr("%1 ms/frame\n%2 nodes, %3 links painted\n%4 index updates")
+                 .arg(frameTime_, 0, 'f', 1)
+                 .arg(nodesPainted_).arg(linksPainted_).arg(indexUpdates_);
+
+  painter->save();
+  painter->resetTransform();
+  QRect box = painter->fontMetrics().boundingRect(QRect(0, 0, 400, 200), Qt::AlignLeft, text);
+  box.translate(8, 8);
+  painter->fillRect(box.adjusted(-4, -4, +4, +4), QColor(255, 255, 224, 220));
+  painter->setPen(Qt::black);
+  painter->drawText(box, Qt::AlignLeft, text);
+  painter->restore();
+}
@@ -0,0 +1,37 @@
+#ifndef DIAGRAMVIEW_H
+#define DIAGRAMVIEW_H
+
+#include <QGraphicsView>
+
+class DiagramView : public QGraphicsView
+{
+  Q_OBJECT
+
+public:
+  DiagramView(QWidget* parent = 0);
+
+  bool showsFrameStats() const;
+
+public slots:
+  void setShowFrameStats(bool show);
+  void updateVisibleRegion();
+
+protected:
+  void paintEvent(QPaintEvent* event);
+  void resizeEvent(QResizeEvent* event);
+  void scrollContentsBy(int dx, int dy);
+  void drawForeground(QPainter* painter, const QRectF& rect);
+
+private:
+  void followViewport();
+
+  QRectF materialized_;
+  bool showFrameStats_;
+  ViewportUpdateMode savedUpdateMode_;
+  double frameTime_;
+  int nodesPainted_;
+  int linksPainted_;
+  int indexUpdates_;
+};
+
+#endif
@@ -1,34 +1,233 @@
 #include <QtGui>
 #include "DiagramWindow.h"
+#include "DiagramScene.h"
+#include "DiagramView.h"
+#include "Graph.h"
 #include "Node.h"
 #include "Link.h"
+#include "DiagramDocument.h"
 #include "propertiesdialog.h"
 
+static const char* const DiagramMimeType = "application/x-diagram-items";
+
 DiagramWindow::DiagramWindow()
 {
-  scene_ = new QGraphicsScene(0, 0, 600, 500);
+  scene_ = new DiagramScene(0, 0, 600, 500);
 
-  view_ = new QGraphicsView;
+  view_ = new DiagramView;
   view_->setScene(scene_);
   view_->setDragMode(QGraphicsView::RubberBandDrag);
   view_->setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
   view_->setContextMenuPolicy(Qt::ActionsContextMenu);
+  view_->viewport()->installEventFilter(this);
   setCentralWidget(view_);
 
-  minZ_ = 0;
-  maxZ_ = 0;
+  pickMode_ = NoPick;
   seqNumber_ = 0;
+  pasteCount_ = 0;
+
+  QSettings settings("Software Inc.", "Diagram");
+  pasteOffset_ = settings.value("pasteOffset", QPointF(20, 20)).toPointF();
+  setRenderCacheLimit(settings.value("renderCacheLimit", 32 * 1024).toInt());
 
   createActions();
   createMenus();
   createToolBars();
 
+  queryWatcher_ = new QFutureWatcher<GraphQueryResult>(this);
+  connect(queryWatcher_, SIGNAL(finished()), this, SLOT(queryFinished()));
+
   connect(scene_, SIGNAL(selectionChanged()), this, SLOT(updateActions()));
+  connect(scene_, SIGNAL(modified()), this, SLOT(diagramModified()));
+  connect(QApplication::clipboard(), SIGNAL(dataChanged()), this, SLOT(clipboardDataChanged()));
+  clipboardDataChanged();
 
-  setWindowTitle(tr("Diagram"));
+  setCurrentFile("");
   updateActions();
 }
 
+void DiagramWindow::open()
+{
+  if (okToContinue())
+  {
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open Diagram"), ".", tr("Diagram files (*.dgm)"));
+    if (!fileName.isEmpty())
+      loadFile(fileName);
+  }
+}
+
+bool DiagramWindow::save()
+{
+  if (curFile_.isEmpty())
+    return saveAs();
+
+  if (!writeFile(curFile_))
+    return false;
+  setWindowModified(false);
+  return true;
+}
+
+bool DiagramWindow::saveAs()
+{
+  QString fileName = QFileDialog::getSaveFileName(this, tr("Save Diagram"), ".", tr("Diagram files (*.dgm)"));
+  if (fileName.isEmpty())
+    return false;
+  if (!writeFile(fileName))
+    return false;
+  setCurrentFile(fileName);
+  return true;
+}
+
+bool DiagramWindow::loadFile(const QString& fileName)
+{
+  if (!readFile(fileName))
+    return false;
+  setCurrentFile(fileName);
+  return true;
+}
+
+void DiagramWindow::setCurrentFile(const QString& fileName)
+{
+  curFile_ = fileName;
+  setWindowModified(false);
+  QString shownName = tr("Untitled");
+  if (!curFile_.isEmpty())
+    shownName = QFileInfo(curFile_).fileName();
+  setWindowTitle(tr("%1[*] - %2").arg(shownName).arg(tr("Diagram")));
+}
+
+void DiagramWindow::diagramModified()
+{
+  setWindowModified(true);
+}
+
+bool DiagramWindow::okToContinue()
+{
+  if (isWindowModified())
+  {
+    int r = QMessageBox::warning(this, tr("Diagram"), tr("The diagram has been modified.\n"
+                                 "Do you want to save your changes?"),
+                                 QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel);
+    if (r == QMessageBox::Yes)
+      return save();
+    else if (r == QMessageBox::Cancel)
+      return false;
+  }
+  return true;
+}
+
+void DiagramWindow::closeEvent(QCloseEvent* event)
+{
+  if (okToContinue())
+    event->accept();
+  else
+    event->ignore();
+}
+
+bool DiagramWindow::readFile(const QString& fileName)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    QMessageBox::warning(this, tr("Diagram"),
+      tr("Cannot read file %1:\n%2.")
+      .arg(file.fileName())
+      .arg(file.errorString()));
+    return false;
+  }
+
+  QDataStream in(&file);
+  in.setVersion(QDataStream::Qt_4_7);
+
+  quint32 magic;
+  in >> magic;
+  if (magic != DiagramMagicNumber)
+  {
+    QMessageBox::warning(this, tr("Diagram"), tr("The file is not a Diagram file."));
+    return false;
+  }
+
+  // The file is read into a scene of its own, so that a corrupt file or
+  // a cancelled load leaves the current diagram as it was.
+  DiagramScene* scene = new DiagramScene(0, 0, 600, 500);
+  scene->setVirtualized(scene_->isVirtualized());
+
+  DiagramReader reader(in, scene);
+  reader.setVirtual(scene->isVirtualized());
+  bool ok = reader.readHeader();
+  if (ok)
+  {
+    QProgressDialog progress(tr("Loading %1...").arg(QFileInfo(fileName).fileName()),
+                             tr("Cancel"), 0, reader.itemCount(), this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(500);
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    while (ok && !reader.atEnd() && !progress.wasCanceled())
+    {
+      ok = reader.readChunk();
+      progress.setValue(reader.itemsRead());
+    }
+    reader.finish();
+    QApplication::restoreOverrideCursor();
+
+    if (progress.wasCanceled())
+    {
+      delete scene;
+      return false;
+    }
+  }
+
+  if (!ok)
+  {
+    delete scene;
+    QMessageBox::warning(this, tr("Diagram"), tr("The file %1 is corrupt.").arg(file.fileName()));
+    return false;
+  }
+
+  scene->setSceneRect(scene->diagramBounds().united(QRectF(0, 0, 600, 500)));
+  setScene(scene);
+  seqNumber_ = scene_->graph().nodeCount();
+  return true;
+}
+
+// Shows scene in place of the current one, which is deleted.
+void DiagramWindow::setScene(DiagramScene* scene)
+{
+  setPickMode(NoPick);
+  DiagramScene* old = scene_;
+  scene_ = scene;
+  view_->setScene(scene_);
+  connect(scene_, SIGNAL(selectionChanged()), this, SLOT(updateActions()));
+  connect(scene_, SIGNAL(modified()), this, SLOT(diagramModified()));
+  delete old;
+  view_->updateVisibleRegion();
+  updateActions();
+}
+
+bool DiagramWindow::writeFile(const QString& fileName)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    QMessageBox::warning(this, tr("Diagram"),
+      tr("Cannot write file %1:\n%2.")
+      .arg(file.fileName())
+      .arg(file.errorString()));
+    return false;
+  }
+
+  QDataStream out(&file);
+  out.setVersion(QDataStream::Qt_4_7);
+
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  out << quint32(DiagramMagicNumber);
+  DiagramWriter writer(out);
+  writer.write(scene_->graph());
+  QApplication::restoreOverrideCursor();
+  return true;
+}
+
 void DiagramWindow::addNode()
 {
   Node* node = new Node;
@@ -49,37 +248,81 @@ void DiagramWindow::setupNode(Node* node)
 
 void DiagramWindow::bringToFront()
 {
-  ++maxZ_;
-  setZValue(maxZ_);
+  scene_->stackingOrder().raiseToFront(selectedNodeIds());
+  setWindowModified(true);
 }
 
 void DiagramWindow::sendToBack()
 {
-  --minZ_;
-  setZValue(minZ_);
+  scene_->stackingOrder().lowerToBack(selectedNodeIds());
+  setWindowModified(true);
 }
 
-void DiagramWindow::setZValue(int z)
+void DiagramWindow::placeAbove()
 {
-  Node* node = selectedNode();
-  if (node)
-    node->setZValue(z);
+  setPickMode(PickAbove);
+}
+
+void DiagramWindow::placeBelow()
+{
+  setPickMode(PickBelow);
+}
+
+// While picking, the next click on the view chooses the node that the
+// selection is restacked against; a click anywhere else cancels.
+void DiagramWindow::setPickMode(PickMode mode)
+{
+  pickMode_ = mode;
+  if (mode == NoPick)
+  {
+    view_->viewport()->unsetCursor();
+    statusBar()->clearMessage();
+  }
+  else
+  {
+    view_->viewport()->setCursor(Qt::CrossCursor);
+    statusBar()->showMessage(mode == PickAbove
+                             ? tr("Click the node to place the selection above")
+                             : tr("Click the node to place the selection below"));
+  }
+}
+
+bool DiagramWindow::eventFilter(QObject* object, QEvent* event)
+{
+  if (object == view_->viewport() && pickMode_ != NoPick
+      && event->type() == QEvent::MouseButtonPress)
+  {
+    QMouseEvent* mouseEvent = static_cast<QMouseEvent*>(event);
+    Node* target = 0;
+    foreach (QGraphicsItem* item, view_->items(mouseEvent->pos()))
+    {
+      target = dynamic_cast<Node*>(item);
+      if (target)
+        break;
+    }
+
+    if (target && mouseEvent->button() == Qt::LeftButton)
+    {
+      if (pickMode_ == PickAbove)
+        scene_->stackingOrder().placeAbove(selectedNodeIds(), target->id());
+      else
+        scene_->stackingOrder().placeBelow(selectedNodeIds(), target->id());
+      setWindowModified(true);
+    }
+    setPickMode(NoPick);
+    return true;
+  }
+  return QMainWindow::eventFilter(object, event);
 }
 
 Node* DiagramWindow::selectedNode() const
 {
-  QList<QGraphicsItem*> items = scene_->selectedItems();
-  if (items.count() == 1)
-    return dynamic_cast<Node*>(items.first());
-  return 0;
+  return scene_->selectedNode();
 }
 
 Link* DiagramWindow::selectedLink() const
 {
-  QList<QGraphicsItem*> items = scene_->selectedItems();
-  if (items.count() == 1)
-    return dynamic_cast<Link*>(items.first());
-  return 0;
+  return scene_->selectedLink();
 }
 
 void DiagramWindow::addLink()
@@ -90,35 +333,25 @@ void DiagramWindow::addLink()
 
   Link* link = new Link(nodes.first, nodes.second);
   scene_->addItem(link);
+  setWindowModified(true);
 }
 
 DiagramWindow::NodePair DiagramWindow::selectedNodePair() const
 {
-  QList<QGraphicsItem*> items = scene_->selectedItems();
-  if (items.count() == 2)
+  if (scene_->selectedNodeCount() == 2 && scene_->selectedLinkCount() == 0)
   {
-    Node* first = dynamic_cast<Node*>(items.first());
-    Node* second = dynamic_cast<Node*>(items.last());
-    if (first && second)
-      return NodePair(first, second);
+    QList<Node*> nodes = scene_->selectedNodes();
+    return NodePair(nodes.first(), nodes.last());
   }
   return NodePair();
 }
 
 void DiagramWindow::del()
 {
-  QList<QGraphicsItem*> items = scene_->selectedItems();
-  QMutableListIterator<QGraphicsItem*> i(items);
-  while (i.hasNext())
-  {
-    Link* link = dynamic_cast<Link*>(i.next());
-    if (link)
-    {
-      delete link;
-      i.remove();
-    }
-  }
-  qDeleteAll(items);
+  if (!scene_->hasSelection())
+    return;
+  scene_->deleteSelection();
+  setWindowModified(true);
 }
 
 void DiagramWindow::properties()
@@ -134,63 +367,227 @@ void DiagramWindow::properties()
   else if (link)
   {
     QColor color = QColorDialog::getColor(link->color(), this);
-    if (color.isValid())
+    if (color.isValid() && color != link->color())
+    {
       link->setColor(color);
+      setWindowModified(true);
+    }
+  }
+}
+
+QVector<int> DiagramWindow::selectedNodeIds() const
+{
+  QVector<int> ids;
+  foreach (Node* node, scene_->selectedNodes())
+    ids.append(node->id());
+  return ids;
+}
+
+void DiagramWindow::shortestPath()
+{
+  NodePair nodes = selectedNodePair();
+  if (nodes == NodePair())
+    return;
+
+  startQuery(QtConcurrent::run(GraphQuery::shortestPath, GraphSnapshot(scene_->graph()),
+                               nodes.first->id(), nodes.second->id()));
+}
+
+void DiagramWindow::selectReachable()
+{
+  if (scene_->selectedNodeCount() == 0)
+    return;
+
+  startQuery(QtConcurrent::run(GraphQuery::reachable, GraphSnapshot(scene_->graph()),
+                               selectedNodeIds()));
+}
+
+void DiagramWindow::selectComponent()
+{
+  if (scene_->selectedNodeCount() == 0)
+    return;
+
+  startQuery(QtConcurrent::run(GraphQuery::components, GraphSnapshot(scene_->graph()),
+                               selectedNodeIds()));
+}
+
+void DiagramWindow::startQuery(const QFuture<GraphQueryResult>& future)
+{
+  statusBar()->showMessage(tr("Searching..."));
+  queryWatcher_->setFuture(future);
+}
+
+void DiagramWindow::queryFinished()
+{
+  GraphQueryResult result = queryWatcher_->result();
+  const Graph& graph = scene_->graph();
+  if (result.revision != graph.revision())
+  {
+    statusBar()->showMessage(tr("The diagram changed during the search"), 2000);
+    return;
   }
+  if (result.nodes.isEmpty())
+  {
+    statusBar()->showMessage(tr("No path found"), 2000);
+    return;
+  }
+
+  // In a virtualized scene only the nodes that have items can be selected.
+  QList<Node*> nodes;
+  foreach (int id, result.nodes)
+  {
+    if (graph.node(id))
+      nodes.append(graph.node(id));
+  }
+  QList<Link*> links;
+  foreach (int id, result.links)
+  {
+    if (graph.link(id))
+      links.append(graph.link(id));
+  }
+  scene_->setSelection(nodes, links);
+
+  if (result.componentCount > 0)
+    statusBar()->showMessage(tr("%1 nodes found, %2 components in the diagram")
+                             .arg(result.nodes.count()).arg(result.componentCount), 2000);
+  else
+    statusBar()->showMessage(tr("%1 nodes found").arg(result.nodes.count()), 2000);
+}
+
+void DiagramWindow::setVirtualScene(bool virtualScene)
+{
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  scene_->setVirtualized(virtualScene);
+  view_->updateVisibleRegion();
+  QApplication::restoreOverrideCursor();
 }
 
 void DiagramWindow::cut()
 {
-  Node* node = selectedNode();
-  if (!node)
+  if (scene_->selectedNodeCount() == 0)
     return;
 
   copy();
-  delete node;
+  del();
 }
 
 void DiagramWindow::copy()
 {
-  Node* node = selectedNode();
-  if (!node)
+  QList<Node*> nodes = selectedNodes();
+  if (nodes.isEmpty())
     return;
 
-  QString str = QString("Node %1 %2 %3 %4")
-                .arg(node->textColor().name())
-                .arg(node->outlineColor().name())
-                .arg(node->backgroundColor().name())
-                .arg(node->text());
-  QApplication::clipboard()->setText(str);
+  QSet<Link*> links;
+  foreach (Node* node, nodes)
+  {
+    foreach (Link* link, node->links())
+      links.insert(link);
+  }
+
+  QByteArray data;
+  QDataStream out(&data, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_7);
+  DiagramWriter writer(out);
+  writer.write(nodes, links.toList());
+
+  QStringList texts;
+  foreach (Node* node, nodes)
+    texts.append(node->text());
+
+  QMimeData* mimeData = new QMimeData;
+  mimeData->setData(DiagramMimeType, data);
+  mimeData->setText(texts.join("\n"));
+  QApplication::clipboard()->setMimeData(mimeData);
 }
 
 void DiagramWindow::paste()
 {
-  QString str = QApplication::clipboard()->text();
-  QStringList parts = str.split(" ");
-  if (parts.count() >= 5 && parts.first() == "Node")
+  const QMimeData* mimeData = QApplication::clipboard()->mimeData();
+  if (!mimeData || !mimeData->hasFormat(DiagramMimeType))
+    return;
+
+  QByteArray data = mimeData->data(DiagramMimeType);
+  QDataStream in(&data, QIODevice::ReadOnly);
+  in.setVersion(QDataStream::Qt_4_7);
+
+  ++pasteCount_;
+  DiagramReader reader(in, scene_);
+  reader.setOffset(pasteOffset_ * pasteCount_);
+  if (!reader.readHeader())
+    return;
+  while (!reader.atEnd())
   {
-    Node* node = new Node;
-    node->setText(QStringList(parts.mid(4)).join(" "));
-    node->setTextColor(QColor(parts[1]));
-    node->setOutlineColor(QColor(parts[2]));
-    node->setBackgroundColor(QColor(parts[3]));
-    setupNode(node);
+    if (!reader.readChunk())
+      break;
   }
+  reader.finish();
+  view_->updateVisibleRegion();
+
+  QVector<int> ids;
+  foreach (Node* node, reader.nodes())
+    ids.append(node->id());
+  scene_->stackingOrder().raiseToFront(ids);
+
+  scene_->clearSelection();
+  foreach (Node* node, reader.nodes())
+    node->setSelected(true);
+  seqNumber_ += ids.count();
+  setWindowModified(true);
+}
+
+void DiagramWindow::setPasteOffset(const QPointF& offset)
+{
+  pasteOffset_ = offset;
+}
+
+QPointF DiagramWindow::pasteOffset() const
+{
+  return pasteOffset_;
+}
+
+// The limit covers the per-node pixmaps the views keep as well as the
+// frames shared between nodes; least recently used ones go first.
+void DiagramWindow::setRenderCacheLimit(int kilobytes)
+{
+  QPixmapCache::setCacheLimit(qMax(0, kilobytes));
+}
+
+int DiagramWindow::renderCacheLimit() const
+{
+  return QPixmapCache::cacheLimit();
+}
+
+void DiagramWindow::clipboardDataChanged()
+{
+  pasteCount_ = 0;
+  const QMimeData* mimeData = QApplication::clipboard()->mimeData();
+  pasteAction_->setEnabled(mimeData && mimeData->hasFormat(DiagramMimeType));
+}
+
+QList<Node*> DiagramWindow::selectedNodes() const
+{
+  return scene_->selectedNodes();
 }
 
 void DiagramWindow::updateActions()
 {
-  bool hasSelection = !scene_->selectedItems().isEmpty();
+  bool hasSelection = scene_->hasSelection();
+  bool hasNodes = (scene_->selectedNodeCount() > 0);
   bool isNode = (selectedNode() != 0);
   bool isNodePair = (selectedNodePair() != NodePair());
 
-  cutAction_->setEnabled(isNode);
-  copyAction_->setEnabled(isNode);
+  cutAction_->setEnabled(hasNodes);
+  copyAction_->setEnabled(hasNodes);
   addLinkAction_->setEnabled(isNodePair);
   deleteAction_->setEnabled(hasSelection);
-  bringToFrontAction_->setEnabled(isNode);
-  sendToBackAction_->setEnabled(isNode);
+  bringToFrontAction_->setEnabled(hasNodes);
+  sendToBackAction_->setEnabled(hasNodes);
+  placeAboveAction_->setEnabled(hasNodes);
+  placeBelowAction_->setEnabled(hasNodes);
   propertiesAction_->setEnabled(isNode);
+  shortestPathAction_->setEnabled(isNodePair);
+  selectReachableAction_->setEnabled(hasNodes);
+  selectComponentAction_->setEnabled(hasNodes);
 
   foreach (QAction* action, view_->actions())
     view_->removeAction(action);
@@ -204,6 +601,18 @@ void DiagramWindow::updateActions()
 
 void DiagramWindow::createActions()
 {
+  openAction_ = new QAction(tr("&Open..."), this);
+  openAction_->setShortcut(QKeySequence::Open);
+  connect(openAction_, SIGNAL(triggered()), this, SLOT(open()));
+
+  saveAction_ = new QAction(tr("&Save"), this);
+  saveAction_->setShortcut(QKeySequence::Save);
+  connect(saveAction_, SIGNAL(triggered()), this, SLOT(save()));
+
+  saveAsAction_ = new QAction(tr("Save &As..."), this);
+  saveAsAction_->setShortcut(QKeySequence::SaveAs);
+  connect(saveAsAction_, SIGNAL(triggered()), this, SLOT(saveAs()));
+
   exitAction_ = new QAction(tr("E&xit"), this);
   exitAction_->setShortcut(tr("Ctrl+Q"));
   connect(exitAction_, SIGNAL(triggered()), this, SLOT(close()));
@@ -248,14 +657,49 @@ void DiagramWindow::createActions()
   connect(sendToBackAction_, SIGNAL(triggered()),
     this, SLOT(sendToBack()));
 
+  placeAboveAction_ = new QAction(tr("Place &Above..."), this);
+  connect(placeAboveAction_, SIGNAL(triggered()),
+    this, SLOT(placeAbove()));
+
+  placeBelowAction_ = new QAction(tr("Place &Below..."), this);
+  connect(placeBelowAction_, SIGNAL(triggered()),
+    this, SLOT(placeBelow()));
+
   propertiesAction_ = new QAction(tr("P&roperties..."), this);
   connect(propertiesAction_, SIGNAL(triggered()),
     this, SLOT(properties()));
+
+  shortestPathAction_ = new QAction(tr("Shortest &Path"), this);
+  connect(shortestPathAction_, SIGNAL(triggered()),
+    this, SLOT(shortestPath()));
+
+  selectReachableAction_ = new QAction(tr("Select &Reachable"), this);
+  connect(selectReachableAction_, SIGNAL(triggered()),
+    this, SLOT(selectReachable()));
+
+  selectComponentAction_ = new QAction(tr("Select &Component"), this);
+  connect(selectComponentAction_, SIGNAL(triggered()),
+    this, SLOT(selectComponent()));
+
+  frameStatsAction_ = new QAction(tr("&Frame Statistics"), this);
+  frameStatsAction_->setShortcut(tr("F12"));
+  frameStatsAction_->setCheckable(true);
+  connect(frameStatsAction_, SIGNAL(toggled(bool)),
+    view_, SLOT(setShowFrameStats(bool)));
+
+  virtualSceneAction_ = new QAction(tr("&Virtual Scene"), this);
+  virtualSceneAction_->setCheckable(true);
+  connect(virtualSceneAction_, SIGNAL(toggled(bool)),
+    this, SLOT(setVirtualScene(bool)));
 }
 
 void DiagramWindow::createMenus()
 {
   fileMenu_ = menuBar()->addMenu(tr("&File"));
+  fileMenu_->addAction(openAction_);
+  fileMenu_->addAction(saveAction_);
+  fileMenu_->addAction(saveAsAction_);
+  fileMenu_->addSeparator();
   fileMenu_->addAction(exitAction_);
 
   editMenu_ = menuBar()->addMenu(tr("&Edit"));
@@ -269,8 +713,19 @@ void DiagramWindow::createMenus()
   editMenu_->addSeparator();
   editMenu_->addAction(bringToFrontAction_);
   editMenu_->addAction(sendToBackAction_);
+  editMenu_->addAction(placeAboveAction_);
+  editMenu_->addAction(placeBelowAction_);
   editMenu_->addSeparator();
   editMenu_->addAction(propertiesAction_);
+
+  graphMenu_ = menuBar()->addMenu(tr("&Graph"));
+  graphMenu_->addAction(shortestPathAction_);
+  graphMenu_->addAction(selectReachableAction_);
+  graphMenu_->addAction(selectComponentAction_);
+
+  viewMenu_ = menuBar()->addMenu(tr("&View"));
+  viewMenu_->addAction(frameStatsAction_);
+  viewMenu_->addAction(virtualSceneAction_);
 }
 
 void DiagramWindow::createToolBars()
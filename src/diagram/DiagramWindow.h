@@ -2,14 +2,16 @@
 #define DIAGRAMWINDOW_H
 
 #include <QMainWindow>
+#include <QFutureWatcher>
+#include "GraphQuery.h"
 
 class Node;
 class Link;
 class QMenu;
 class QToolBar;
 class QAction;
-class QGraphicsScene;
-class QGraphicsView;
+class DiagramScene;
+class DiagramView;
 
 class DiagramWindow : public QMainWindow
 {
@@ -18,7 +20,16 @@ class DiagramWindow : public QMainWindow
 public:
   DiagramWindow();
 
+  bool loadFile(const QString& fileName);
+  void setPasteOffset(const QPointF& offset);
+  QPointF pasteOffset() const;
+  void setRenderCacheLimit(int kilobytes);
+  int renderCacheLimit() const;
+
 private slots:
+  void open();
+  bool save();
+  bool saveAs();
   void addNode();
   void addLink();
   void del();
@@ -27,23 +38,51 @@ private slots:
   void paste();
   void bringToFront();
   void sendToBack();
+  void placeAbove();
+  void placeBelow();
   void properties();
+  void shortestPath();
+  void selectReachable();
+  void selectComponent();
+  void queryFinished();
+  void setVirtualScene(bool virtualScene);
   void updateActions();
+  void clipboardDataChanged();
+  void diagramModified();
+
+protected:
+  bool eventFilter(QObject* object, QEvent* event);
+  void closeEvent(QCloseEvent* event);
 
 private:
   typedef QPair<Node*, Node*> NodePair;
+  enum PickMode { NoPick, PickAbove, PickBelow };
+
+  void setPickMode(PickMode mode);
+  bool okToContinue();
   void createActions();
   void createMenus();
   void createToolBars();
-  void setZValue(int z);
+  bool readFile(const QString& fileName);
+  void setScene(DiagramScene* scene);
+  bool writeFile(const QString& fileName);
+  void setCurrentFile(const QString& fileName);
+  void startQuery(const QFuture<GraphQueryResult>& future);
+  QVector<int> selectedNodeIds() const;
   void setupNode(Node* node);
   Node* selectedNode() const;
+  QList<Node*> selectedNodes() const;
   Link* selectedLink() const;
   NodePair selectedNodePair() const;
 
   QMenu* fileMenu_;
   QMenu* editMenu_;
+  QMenu* graphMenu_;
+  QMenu* viewMenu_;
   QToolBar* editToolBar_;
+  QAction* openAction_;
+  QAction* saveAction_;
+  QAction* saveAsAction_;
   QAction* exitAction_;
   QAction* cutAction_;
   QAction* copyAction_;
@@ -53,14 +92,24 @@ private:
   QAction* addNodeAction_;
   QAction* bringToFrontAction_;
   QAction* sendToBackAction_;
+  QAction* placeAboveAction_;
+  QAction* placeBelowAction_;
   QAction* propertiesAction_;
+  QAction* shortestPathAction_;
+  QAction* selectReachableAction_;
+  QAction* selectComponentAction_;
+  QAction* frameStatsAction_;
+  QAction* virtualSceneAction_;
 
-  QGraphicsScene* scene_;
-  QGraphicsView* view_;
+  DiagramScene* scene_;
+  DiagramView* view_;
+  QFutureWatcher<GraphQueryResult>* queryWatcher_;
   
-  int minZ_;
-  int maxZ_;
+  PickMode pickMode_;
   int seqNumber_;
+  int pasteCount_;
+  QPointF pasteOffset_;
+  QString curFile_;
 };
 
 #endif
\ No newline at end of file
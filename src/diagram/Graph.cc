@@ -0,0 +1,214 @@
+#include "Graph.h"
+
+Graph::Graph()
+{
+  nodeCount_ = 0;
+  linkCount_ = 0;
+  revision_ = 0;
+  zLogComplete_ = true;
+}
+
+int Graph::addNode(Node* item, const QPointF& pos)
+{
+  int node;
+  if (freeNodes_.isEmpty())
+  {
+    node = nodes_.count();
+    nodes_.resize(node + 1);
+  }
+  else
+  {
+    node = freeNodes_.last();
+    freeNodes_.pop_back();
+  }
+
+  NodeRecord& record = nodes_[node];
+  record.item = item;
+  record.pos = pos;
+  record.links.clear();
+  record.text.clear();
+  record.textColor = qRgb(0, 0, 0);
+  record.outlineColor = qRgb(0, 0, 0);
+  record.backgroundColor = qRgb(255, 255, 255);
+  record.z = 0;
+  record.alive = true;
+  ++nodeCount_;
+  ++revision_;
+  logZChange(node, 0, true);
+  return node;
+}
+
+void Graph::removeNode(int node)
+{
+  NodeRecord& record = nodes_[node];
+  Q_ASSERT(record.links.isEmpty());
+  logZChange(node, record.z, false);
+  record.item = 0;
+  record.links.clear();
+  record.text.clear();
+  record.alive = false;
+  freeNodes_.append(node);
+  --nodeCount_;
+  ++revision_;
+}
+
+int Graph::addLink(int fromNode, int toNode, Link* item)
+{
+  int link;
+  if (freeLinks_.isEmpty())
+  {
+    link = links_.count();
+    links_.resize(link + 1);
+  }
+  else
+  {
+    link = freeLinks_.last();
+    freeLinks_.pop_back();
+  }
+
+  LinkRecord& record = links_[link];
+  record.item = item;
+  record.from = fromNode;
+  record.to = toNode;
+  record.color = qRgb(0, 0, 0);
+
+  nodes_[fromNode].links.append(link);
+  if (toNode != fromNode)
+    nodes_[toNode].links.append(link);
+  ++linkCount_;
+  ++revision_;
+  return link;
+}
+
+void Graph::removeLink(int link)
+{
+  LinkRecord& record = links_[link];
+  detachLink(record.from, link);
+  if (record.to != record.from)
+    detachLink(record.to, link);
+
+  record.item = 0;
+  record.from = -1;
+  record.to = -1;
+  freeLinks_.append(link);
+  --linkCount_;
+  ++revision_;
+}
+
+// Removes a batch of nodes and links in one pass. The links must include
+// every link attached to the nodes; adjacency lists are only patched for
+// the surviving endpoints.
+void Graph::removeItems(const QVector<int>& nodes, const QVector<int>& links)
+{
+  foreach (int node, nodes)
+  {
+    logZChange(node, nodes_[node].z, false);
+    nodes_[node].item = 0;
+    nodes_[node].links.clear();
+    nodes_[node].text.clear();
+    nodes_[node].alive = false;
+    freeNodes_.append(node);
+  }
+
+  foreach (int link, links)
+  {
+    LinkRecord& record = links_[link];
+    if (nodes_[record.from].alive)
+      detachLink(record.from, link);
+    if (record.to != record.from && nodes_[record.to].alive)
+      detachLink(record.to, link);
+
+    record.item = 0;
+    record.from = -1;
+    record.to = -1;
+    freeLinks_.append(link);
+  }
+
+  nodeCount_ -= nodes.count();
+  linkCount_ -= links.count();
+  ++revision_;
+}
+
+void Graph::reserve(int nodeCount, int linkCount)
+{
+  nodes_.reserve(nodes_.count() - freeNodes_.count() + nodeCount);
+  links_.reserve(links_.count() - freeLinks_.count() + linkCount);
+}
+
+void Graph::clear()
+{
+  nodes_.clear();
+  links_.clear();
+  freeNodes_.clear();
+  freeLinks_.clear();
+  nodeCount_ = 0;
+  linkCount_ = 0;
+  ++revision_;
+  zLog_.clear();
+  zLogComplete_ = false;
+}
+
+void Graph::setZValue(int node, qreal z)
+{
+  NodeRecord& record = nodes_[node];
+  if (record.z == z)
+    return;
+  logZChange(node, record.z, false);
+  record.z = z;
+  logZChange(node, z, true);
+}
+
+// Hands over the z changes logged since the last call, or, when changes
+// is 0, just forgets them. Returns false, with nothing handed over, if
+// the log outgrew ZLogLimit or the graph was cleared; the stacking order
+// is then cheaper to rebuild than to patch.
+bool Graph::takeZChanges(QVector<ZChange>* changes)
+{
+  bool complete = zLogComplete_;
+  if (changes)
+  {
+    changes->clear();
+    if (complete)
+      *changes = zLog_;
+  }
+  zLog_.clear();
+  zLogComplete_ = true;
+  return complete;
+}
+
+int Graph::otherNode(int link, int node) const
+{
+  const LinkRecord& record = links_[link];
+  return record.from == node ? record.to : record.from;
+}
+
+void Graph::detachLink(int node, int link)
+{
+  LinkList& links = nodes_[node].links;
+  for (int i = 0; i < links.count(); ++i)
+  {
+    if (links[i] == link)
+    {
+      links[i] = links[links.count() - 1];
+      links.resize(links.count() - 1);
+      return;
+    }
+  }
+}
+
+void Graph::logZChange(int node, qreal z, bool added)
+{
+  if (!zLogComplete_)
+    return;
+  if (zLog_.count() == ZLogLimit)
+  {
+    zLog_.clear();
+    zLogComplete_ = false;
+    return;
+  }
+  ZChange change;
+  change.node = node;
+  change.z = z;
+  change.added = added;
+  zLog_.append(change);
+}
@@ -0,0 +1,115 @@
+#ifndef DIAGRAMGRAPH_H
+#define DIAGRAMGRAPH_H
+
+#include <QPointF>
+#include <QRgb>
+#include <QString>
+#include <QVarLengthArray>
+#include <QVector>
+
+class Node;
+class Link;
+
+// Topology of a diagram. Nodes and links are addressed by integer handles
+// that stay valid until the node or link is removed; freed handles are
+// reused. Each node keeps its incident links inline for the common case of
+// a low degree, so walking the graph does not touch the scene items.
+// Records also hold what is needed to draw a node or link, so a record can
+// exist without a scene item; node() and link() return 0 for those.
+class Graph
+{
+public:
+  typedef QVarLengthArray<int, 4> LinkList;
+
+  // A node entering the stacking order at z, or leaving it. A new z value
+  // is logged as leaving at the old value and entering at the new one.
+  struct ZChange
+  {
+    int node;
+    qreal z;
+    bool added;
+  };
+
+  enum { ZLogLimit = 256 };
+
+  Graph();
+
+  int addNode(Node* item, const QPointF& pos);
+  void removeNode(int node);
+  int addLink(int fromNode, int toNode, Link* item);
+  void removeLink(int link);
+  void removeItems(const QVector<int>& nodes, const QVector<int>& links);
+  void reserve(int nodeCount, int linkCount);
+  void clear();
+
+  int revision() const { return revision_; }
+  bool takeZChanges(QVector<ZChange>* changes);
+  int nodeCount() const { return nodeCount_; }
+  int linkCount() const { return linkCount_; }
+  int nodeCapacity() const { return nodes_.count(); }
+  int linkCapacity() const { return links_.count(); }
+
+  bool hasNode(int node) const { return nodes_[node].alive; }
+  bool hasLink(int link) const { return links_[link].from >= 0; }
+  Node* node(int node) const { return nodes_[node].item; }
+  Link* link(int link) const { return links_[link].item; }
+  void setNode(int node, Node* item) { nodes_[node].item = item; }
+  void setLink(int link, Link* item) { links_[link].item = item; }
+  const LinkList& links(int node) const { return nodes_[node].links; }
+  int fromNode(int link) const { return links_[link].from; }
+  int toNode(int link) const { return links_[link].to; }
+  int otherNode(int link, int node) const;
+
+  QPointF position(int node) const { return nodes_[node].pos; }
+  void setPosition(int node, const QPointF& pos) { nodes_[node].pos = pos; }
+
+  QString text(int node) const { return nodes_[node].text; }
+  void setText(int node, const QString& text) { nodes_[node].text = text; }
+  QRgb textColor(int node) const { return nodes_[node].textColor; }
+  void setTextColor(int node, QRgb color) { nodes_[node].textColor = color; }
+  QRgb outlineColor(int node) const { return nodes_[node].outlineColor; }
+  void setOutlineColor(int node, QRgb color) { nodes_[node].outlineColor = color; }
+  QRgb backgroundColor(int node) const { return nodes_[node].backgroundColor; }
+  void setBackgroundColor(int node, QRgb color) { nodes_[node].backgroundColor = color; }
+  qreal zValue(int node) const { return nodes_[node].z; }
+  void setZValue(int node, qreal z);
+  QRgb linkColor(int link) const { return links_[link].color; }
+  void setLinkColor(int link, QRgb color) { links_[link].color = color; }
+
+private:
+  struct NodeRecord
+  {
+    Node* item;
+    QPointF pos;
+    LinkList links;
+    QString text;
+    QRgb textColor;
+    QRgb outlineColor;
+    QRgb backgroundColor;
+    qreal z;
+    bool alive;
+  };
+
+  struct LinkRecord
+  {
+    Link* item;
+    int from;
+    int to;
+    QRgb color;
+  };
+
+  void detachLink(int node, int link);
+  void logZChange(int node, qreal z, bool added);
+
+  QVector<NodeRecord> nodes_;
+  QVector<LinkRecord> links_;
+  QVector<int> freeNodes_;
+  QVector<int> freeLinks_;
+  int nodeCount_;
+  int linkCount_;
+  int revision_;
+  QVector<ZChange> zLog_;
+  bool zLogComplete_;
+};
+
+#endif
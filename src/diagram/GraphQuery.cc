@@ -0,0 +1,193 @@
+#include <QtCore>
+#include <functional>
+#include <queue>
+#include <vector>
+#include "GraphQuery.h"
+#include "Graph.h"
+
+GraphSnapshot::GraphSnapshot()
+{
+  revision = -1;
+}
+
+GraphSnapshot::GraphSnapshot(const Graph& graph)
+{
+  revision = graph.revision();
+
+  int capacity = graph.nodeCapacity();
+  int entries = 2 * graph.linkCount();
+  alive.resize(capacity);
+  offsets.resize(capacity + 1);
+  targets.reserve(entries);
+  links.reserve(entries);
+  lengths.reserve(entries);
+  outgoing.reserve(entries);
+
+  for (int node = 0; node < capacity; ++node)
+  {
+    offsets[node] = targets.count();
+    alive[node] = graph.hasNode(node);
+    if (!alive[node])
+      continue;
+
+    QPointF pos = graph.position(node);
+    const Graph::LinkList& nodeLinks = graph.links(node);
+    for (int i = 0; i < nodeLinks.count(); ++i)
+    {
+      int link = nodeLinks[i];
+      int other = graph.otherNode(link, node);
+      targets.append(other);
+      links.append(link);
+      lengths.append(QLineF(pos, graph.position(other)).length());
+      outgoing.append(graph.fromNode(link) == node);
+    }
+  }
+  offsets[capacity] = targets.count();
+}
+
+// Dijkstra over the undirected graph, weighted by the on-screen length of
+// each link.
+GraphQueryResult GraphQuery::shortestPath(const GraphSnapshot& graph, int source, int target)
+{
+  typedef std::pair<float, int> Entry;
+
+  GraphQueryResult result;
+  result.revision = graph.revision;
+
+  int capacity = graph.offsets.count() - 1;
+  QVector<float> distance(capacity, -1);
+  QVector<int> viaNode(capacity, -1);
+  QVector<int> viaLink(capacity, -1);
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+
+  distance[source] = 0;
+  queue.push(Entry(0, source));
+  while (!queue.empty())
+  {
+    Entry entry = queue.top();
+    queue.pop();
+    int node = entry.second;
+    if (entry.first > distance[node])
+      continue;
+    if (node == target)
+      break;
+
+    for (int i = graph.offsets[node]; i < graph.offsets[node + 1]; ++i)
+    {
+      int other = graph.targets[i];
+      float d = entry.first + graph.lengths[i];
+      if (distance[other] < 0 || d < distance[other])
+      {
+        distance[other] = d;
+        viaNode[other] = node;
+        viaLink[other] = graph.links[i];
+        queue.push(Entry(d, other));
+      }
+    }
+  }
+
+  if (distance[target] < 0)
+    return result;
+
+  int node = target;
+  result.nodes.append(node);
+  while (node != source)
+  {
+    result.links.append(viaLink[node]);
+    node = viaNode[node];
+    result.nodes.append(node);
+  }
+  return result;
+}
+
+// Everything that can be reached from the sources by following links in
+// their from-to direction.
+GraphQueryResult GraphQuery::reachable(const GraphSnapshot& graph, const QVector<int>& sources)
+{
+  GraphQueryResult result;
+  result.revision = graph.revision;
+
+  QVector<quint8> visited(graph.offsets.count() - 1, 0);
+  QVector<int> queue;
+  foreach (int source, sources)
+  {
+    if (!visited[source])
+    {
+      visited[source] = 1;
+      queue.append(source);
+    }
+  }
+
+  for (int head = 0; head < queue.count(); ++head)
+  {
+    int node = queue[head];
+    for (int i = graph.offsets[node]; i < graph.offsets[node + 1]; ++i)
+    {
+      if (!graph.outgoing[i])
+        continue;
+      result.links.append(graph.links[i]);
+      int other = graph.targets[i];
+      if (!visited[other])
+      {
+        visited[other] = 1;
+        queue.append(other);
+      }
+    }
+  }
+  result.nodes = queue;
+  return result;
+}
+
+// Labels the connected components of the undirected graph and returns the
+// ones that contain the sources, plus the total number of components.
+GraphQueryResult GraphQuery::components(const GraphSnapshot& graph, const QVector<int>& sources)
+{
+  GraphQueryResult result;
+  result.revision = graph.revision;
+
+  int capacity = graph.offsets.count() - 1;
+  QVector<int> component(capacity, -1);
+  QVector<int> queue;
+  queue.reserve(capacity);
+
+  for (int start = 0; start < capacity; ++start)
+  {
+    if (component[start] != -1 || !graph.alive[start])
+      continue;
+
+    queue.clear();
+    queue.append(start);
+    component[start] = result.componentCount;
+    for (int head = 0; head < queue.count(); ++head)
+    {
+      int node = queue[head];
+      for (int i = graph.offsets[node]; i < graph.offsets[node + 1]; ++i)
+      {
+        int other = graph.targets[i];
+        if (component[other] == -1)
+        {
+          component[other] = result.componentCount;
+          queue.append(other);
+        }
+      }
+    }
+    ++result.componentCount;
+  }
+
+  QVector<quint8> wanted(result.componentCount, 0);
+  foreach (int source, sources)
+    wanted[component[source]] = 1;
+
+  for (int node = 0; node < capacity; ++node)
+  {
+    if (component[node] == -1 || !wanted[component[node]])
+      continue;
+    result.nodes.append(node);
+    for (int i = graph.offsets[node]; i < graph.offsets[node + 1]; ++i)
+    {
+      if (graph.outgoing[i])
+        result.links.append(graph.links[i]);
+    }
+  }
+  return result;
+}
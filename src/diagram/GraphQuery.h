@@ -0,0 +1,44 @@
+#ifndef DIAGRAMGRAPHQUERY_H
+#define DIAGRAMGRAPHQUERY_H
+
+#include <QVector>
+
+class Graph;
+
+// Compressed adjacency copy of a Graph, indexed by the graph's handles.
+// Node n's links are the entries offsets[n] .. offsets[n + 1] - 1. It holds
+// no item pointers, so queries can run on it from a worker thread.
+class GraphSnapshot
+{
+public:
+  GraphSnapshot();
+  explicit GraphSnapshot(const Graph& graph);
+
+  int revision;
+  QVector<quint8> alive;
+  QVector<int> offsets;
+  QVector<int> targets;
+  QVector<int> links;
+  QVector<float> lengths;
+  QVector<quint8> outgoing;
+};
+
+struct GraphQueryResult
+{
+  GraphQueryResult() : revision(-1), componentCount(0) {}
+
+  int revision;
+  QVector<int> nodes;
+  QVector<int> links;
+  int componentCount;
+};
+
+class GraphQuery
+{
+public:
+  static GraphQueryResult shortestPath(const GraphSnapshot& graph, int source, int target);
+  static GraphQueryResult reachable(const GraphSnapshot& graph, const QVector<int>& sources);
+  static GraphQueryResult components(const GraphSnapshot& graph, const QVector<int>& sources);
+};
+
+#endif
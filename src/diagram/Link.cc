@@ -1,14 +1,24 @@
 #include <QtGui>
 #include "Link.h"
 #include "Node.h"
+#include "DiagramScene.h"
+#include "Graph.h"
+#include "RenderStats.h"
 
+// Both nodes must already be in the same DiagramScene, as the link is a
+// record in its graph. Otherwise the link is left unbound: it joins no
+// graph, draws nothing and reports no nodes.
 Link::Link(Node* fromNode, Node* toNode)
 {
-  myFromNode_ = fromNode;
-  myToNode_ = toNode;
-
-  myFromNode_->addLink(this);
-  myToNode_->addLink(this);
+  graph_ = 0;
+  id_ = -1;
+  if (fromNode->graph() && fromNode->graph() == toNode->graph())
+  {
+    graph_ = fromNode->graph();
+    id_ = graph_->addLink(fromNode->id(), toNode->id(), this);
+  }
+  else
+    qWarning("Link: the nodes are not in the same diagram scene");
 
   setFlags(QGraphicsItem::ItemIsSelectable);
   setZValue(-1);
@@ -17,15 +27,62 @@ Link::Link(Node* fromNode, Node* toNode)
   trackNodes();
 }
 
+// An unbound item for DiagramScene to attach() to a link record.
+Link::Link()
+{
+  graph_ = 0;
+  id_ = -1;
+
+  setFlags(QGraphicsItem::ItemIsSelectable);
+  setZValue(-1);
+}
+
 Link::~Link()
 {
-  myFromNode_->removeLink(this);
-  myToNode_->removeLink(this);
+  DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+  if (diagram && isSelected())
+    diagram->linkSelectionChanged(this, false);
+
+  if (graph_)
+    graph_->removeLink(id_);
+}
+
+Node* Link::fromNode() const
+{
+  return graph_ ? graph_->node(graph_->fromNode(id_)) : 0;
+}
+
+Node* Link::toNode() const
+{
+  return graph_ ? graph_->node(graph_->toNode(id_)) : 0;
+}
+
+int Link::id() const
+{
+  return id_;
+}
+
+void Link::attach(Graph* graph, int id)
+{
+  graph_ = graph;
+  id_ = id;
+  graph_->setLink(id_, this);
+  setColor(QColor::fromRgba(graph_->linkColor(id_)));
+  trackNodes();
+}
+
+void Link::detach()
+{
+  graph_->setLink(id_, 0);
+  graph_ = 0;
+  id_ = -1;
 }
 
 void Link::setColor(const QColor& color)
 {
   setPen(QPen(color, 1.0));
+  if (graph_)
+    graph_->setLinkColor(id_, color.rgba());
 }
 
 QColor Link::color() const
@@ -35,5 +92,38 @@ QColor Link::color() const
 
 void Link::trackNodes()
 {
-  setLine(QLineF(myFromNode_->pos(), myToNode_->pos()));
+  if (!graph_)
+    return;
+  setLine(QLineF(graph_->position(graph_->fromNode(id_)),
+                 graph_->position(graph_->toNode(id_))));
+  RenderStats::indexUpdated();
+}
+
+void Link::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget)
+{
+  QGraphicsLineItem::paint(painter, option, widget);
+  RenderStats::linkPainted();
+}
+
+QVariant Link::itemChange(GraphicsItemChange change, const QVariant& value)
+{
+  if (change == ItemSelectedHasChanged)
+  {
+    DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+    if (diagram)
+      diagram->linkSelectionChanged(this, value.toBool());
+  }
+  else if (change == ItemSceneChange && isSelected())
+  {
+    DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+    if (diagram)
+      diagram->linkSelectionChanged(this, false);
+  }
+  else if (change == ItemSceneHasChanged && isSelected())
+  {
+    DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+    if (diagram)
+      diagram->linkSelectionChanged(this, true);
+  }
+  return QGraphicsLineItem::itemChange(change, value);
 }
\ No newline at end of file
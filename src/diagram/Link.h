@@ -4,6 +4,7 @@
 #include <QGraphicsLineItem>
 
 class Node;
+class Graph;
 
 class Link : public QGraphicsLineItem
 {
@@ -11,17 +12,30 @@ public:
 	Link(Node* fromNode, Node* toNode);
   ~Link();
 
+  // 0 while the node is only a record in a virtualized scene, or for a
+  // link made between nodes that were not in the same scene.
   Node* fromNode() const;
   Node* toNode() const;
+  int id() const;
 
   void setColor(const QColor& color);
   QColor color() const;
 
   void trackNodes();
+  void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget);
+
+protected:
+  QVariant itemChange(GraphicsItemChange change, const QVariant& value);
 
 private:
-  Node* myFromNode_;
-  Node* myToNode_;
+  friend class DiagramScene;
+
+  Link();
+  void attach(Graph* graph, int id);
+  void detach();
+
+  Graph* graph_;
+  int id_;
 };
 
 #endif
\ No newline at end of file
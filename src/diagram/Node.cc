@@ -1,82 +1,214 @@
 #include <QtGui>
 #include "Node.h"
 #include "Link.h"
+#include "DiagramScene.h"
+#include "Graph.h"
+#include "RenderStats.h"
+
+// Shared frame pixmaps are rendered at one of ZoomBucketsPerOctave scales
+// per doubling of the zoom, so a gradual zoom reuses them until it crosses
+// into the next bucket.
+static const int ZoomBucketsPerOctave = 4;
+
+static int zoomBucket(qreal levelOfDetail)
+{
+  return qRound(qLn(qMax(levelOfDetail, qreal(1e-3))) / qLn(2.0) * ZoomBucketsPerOctave);
+}
+
+static qreal bucketScale(int bucket)
+{
+  return qPow(2.0, qreal(bucket) / ZoomBucketsPerOctave);
+}
 
 Node::Node()
 {
-  textColor_ = Qt::darkGreen;
-  outlineColor_ = Qt::darkBlue;
-  backgroundColor_ = Qt::white;
+  graph_ = 0;
+  id_ = -1;
+  detached_ = 0;
 
   setFlags(ItemIsMovable | ItemIsSelectable | ItemSendsGeometryChanges);
+
+  // A view blits the cached node while panning and only calls paint()
+  // again after update(), which every setter below ends with, or after
+  // the view's transform changes.
+  setCacheMode(DeviceCoordinateCache);
 }
 
 Node::~Node()
 {
-  foreach (Link* link, links_)
-    delete link;
+  DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+  if (diagram && isSelected())
+    diagram->nodeSelectionChanged(this, false);
+
+  if (graph_)
+  {
+    while (!graph_->links(id_).isEmpty())
+    {
+      int link = graph_->links(id_).at(0);
+      if (graph_->link(link))
+        delete graph_->link(link);
+      else
+        graph_->removeLink(link);
+    }
+    graph_->removeNode(id_);
+  }
+  delete detached_;
+}
+
+Node::Detached* Node::detached()
+{
+  if (!detached_)
+  {
+    detached_ = new Detached;
+    detached_->textColor = QColor(Qt::darkGreen).rgba();
+    detached_->outlineColor = QColor(Qt::darkBlue).rgba();
+    detached_->backgroundColor = QColor(Qt::white).rgba();
+  }
+  return detached_;
+}
+
+// Only a change to a node in a scene makes the diagram modified.
+void Node::markModified()
+{
+  DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+  if (diagram)
+    diagram->markModified();
 }
 
 void Node::setText(const QString& text)
 {
   prepareGeometryChange();
-  text_ = text;
+  if (graph_)
+  {
+    if (graph_->text(id_) != text)
+      markModified();
+    graph_->setText(id_, text);
+  }
+  else
+    detached()->text = text;
   update();
 }
 
 QString Node::text() const
 {
-  return text_;
+  if (graph_)
+    return graph_->text(id_);
+  return detached_ ? detached_->text : QString();
 }
 
 void Node::setTextColor(const QColor& color)
 {
-  textColor_ = color;
+  if (graph_)
+  {
+    if (graph_->textColor(id_) != color.rgba())
+      markModified();
+    graph_->setTextColor(id_, color.rgba());
+  }
+  else
+    detached()->textColor = color.rgba();
   update();
 }
 
 QColor Node::textColor() const
 {
-  return textColor_;
+  if (graph_)
+    return QColor::fromRgba(graph_->textColor(id_));
+  return detached_ ? QColor::fromRgba(detached_->textColor) : QColor(Qt::darkGreen);
 }
 
 void Node::setOutlineColor(const QColor& color)
 {
-  outlineColor_ = color;
+  if (graph_)
+  {
+    if (graph_->outlineColor(id_) != color.rgba())
+      markModified();
+    graph_->setOutlineColor(id_, color.rgba());
+  }
+  else
+    detached()->outlineColor = color.rgba();
   update();
 }
 
 QColor Node::outlineColor() const
 {
-  return outlineColor_;
+  if (graph_)
+    return QColor::fromRgba(graph_->outlineColor(id_));
+  return detached_ ? QColor::fromRgba(detached_->outlineColor) : QColor(Qt::darkBlue);
 }
 
 void Node::setBackgroundColor(const QColor& color)
 {
-  backgroundColor_ = color;
+  if (graph_)
+  {
+    if (graph_->backgroundColor(id_) != color.rgba())
+      markModified();
+    graph_->setBackgroundColor(id_, color.rgba());
+  }
+  else
+    detached()->backgroundColor = color.rgba();
   update();
 }
 
 QColor Node::backgroundColor() const
 {
-  return backgroundColor_;
+  if (graph_)
+    return QColor::fromRgba(graph_->backgroundColor(id_));
+  return detached_ ? QColor::fromRgba(detached_->backgroundColor) : QColor(Qt::white);
+}
+
+Graph* Node::graph() const
+{
+  return graph_;
 }
 
-void Node::addLink(Link* link)
+int Node::id() const
 {
-  links_.insert(link);
+  return id_;
 }
 
-void Node::removeLink(Link* link)
+QList<Link*> Node::links() const
 {
-  links_.remove(link);
+  QList<Link*> links;
+  if (graph_)
+  {
+    const Graph::LinkList& ids = graph_->links(id_);
+    for (int i = 0; i < ids.count(); ++i)
+    {
+      if (graph_->link(ids[i]))
+        links.append(graph_->link(ids[i]));
+    }
+  }
+  return links;
+}
+
+// Binds the item to an existing record, which is how a virtualized scene
+// brings a node into view, possibly reusing an item released elsewhere.
+void Node::attach(Graph* graph, int id)
+{
+  prepareGeometryChange();
+  graph_ = graph;
+  id_ = id;
+  graph_->setNode(id_, this);
+  delete detached_;
+  detached_ = 0;
+  update();
+  setPos(graph_->position(id_));
+  setZValue(graph_->zValue(id_));
+}
+
+// Unbinds the item and leaves the record, with its links, in the graph.
+void Node::detach()
+{
+  graph_->setNode(id_, 0);
+  graph_ = 0;
+  id_ = -1;
 }
 
 QRectF Node::outlineRect() const
 {
   const int Padding = 8;
   QFontMetricsF metrics = qApp->font();
-  QRectF rect = metrics.boundingRect(text_);
+  QRectF rect = metrics.boundingRect(text());
   rect.adjust(-Padding, -Padding, +Padding, +Padding);
   rect.translate(-rect.center());
   return rect;
@@ -98,34 +230,134 @@ QPainterPath Node::shape() const
 
 void Node::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* /*widget*/)
 {
-  QPen pen(outlineColor_);
-  if (option->state & QStyle::State_Selected)
+  bool selected = option->state & QStyle::State_Selected;
+  QRectF rect = outlineRect();
+
+  // Pixmaps may only be used on the GUI thread of an application with a
+  // window system, which the command-line exporter does not have, and
+  // vector devices such as SVG and PDF exports must get real outlines
+  // rather than bitmaps.
+  int deviceType = painter->device()->devType();
+  if (QThread::currentThread() == qApp->thread() && QApplication::type() != QApplication::Tty
+      && (deviceType == QInternal::Widget || deviceType == QInternal::Pixmap
+          || deviceType == QInternal::Image))
+  {
+    qreal levelOfDetail = option->levelOfDetailFromTransform(painter->worldTransform());
+    QPixmap pixmap = framePixmap(rect, selected, levelOfDetail);
+    painter->save();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    painter->drawPixmap(boundingRect(), pixmap, QRectF(pixmap.rect()));
+    painter->restore();
+  }
+  else
+    paintFrame(painter, rect, selected);
+
+  painter->setPen(textColor());
+  painter->drawText(rect, Qt::AlignCenter, text());
+  RenderStats::nodePainted();
+}
+
+void Node::paintFrame(QPainter* painter, const QRectF& rect, bool selected) const
+{
+  QPen pen(outlineColor());
+  if (selected)
   {
     pen.setStyle(Qt::DotLine);
     pen.setWidth(2);
   }
   painter->setPen(pen);
-  painter->setBrush(backgroundColor_);
-
-  QRectF rect = outlineRect();
+  painter->setBrush(backgroundColor());
   painter->drawRoundRect(rect, roundness(rect.width()), roundness(rect.height()));
-  painter->setPen(textColor_);
-  painter->drawText(rect, Qt::AlignCenter, text_);
+}
+
+// Nodes with the same colors, outline size and selection state share one
+// frame pixmap per zoom bucket in QPixmapCache. A color change yields a new
+// key, so stale frames are never drawn and simply age out of the cache.
+QPixmap Node::framePixmap(const QRectF& rect, bool selected, qreal levelOfDetail) const
+{
+  int bucket = zoomBucket(levelOfDetail);
+  QString key = QString("DiagramNodeFrame:%1:%2:%3x%4:%5:%6")
+                .arg(outlineColor().rgba()).arg(backgroundColor().rgba())
+                .arg(rect.width()).arg(rect.height())
+                .arg(int(selected)).arg(bucket);
+
+  QPixmap pixmap;
+  if (QPixmapCache::find(key, &pixmap))
+    return pixmap;
+
+  QRectF bounds = boundingRect();
+  qreal scale = bucketScale(bucket);
+  pixmap = QPixmap(qMax(1, qCeil(bounds.width() * scale)), qMax(1, qCeil(bounds.height() * scale)));
+  pixmap.fill(Qt::transparent);
+  {
+    QPainter painter(&pixmap);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.scale(pixmap.width() / bounds.width(), pixmap.height() / bounds.height());
+    painter.translate(-bounds.topLeft());
+    paintFrame(&painter, rect, selected);
+  }
+  QPixmapCache::insert(key, pixmap);
+  return pixmap;
 }
 
 QVariant Node::itemChange(GraphicsItemChange change, const QVariant& value)
 {
   if (change == ItemPositionHasChanged)
   {
-    foreach (Link* link, links_)
-      link->trackNodes();
+    RenderStats::indexUpdated();
+    if (graph_)
+    {
+      // attach() moves the item to where its record already is.
+      if (graph_->position(id_) != pos())
+        markModified();
+      graph_->setPosition(id_, pos());
+      const Graph::LinkList& ids = graph_->links(id_);
+      for (int i = 0; i < ids.count(); ++i)
+      {
+        if (graph_->link(ids[i]))
+          graph_->link(ids[i])->trackNodes();
+      }
+    }
+  }
+  else if (change == ItemZValueHasChanged && graph_)
+    graph_->setZValue(id_, zValue());
+  else if (change == ItemSelectedHasChanged)
+  {
+    DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+    if (diagram)
+      diagram->nodeSelectionChanged(this, value.toBool());
+  }
+  else if (change == ItemSceneChange && isSelected())
+  {
+    DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+    if (diagram)
+      diagram->nodeSelectionChanged(this, false);
+  }
+  else if (change == ItemSceneHasChanged)
+  {
+    DiagramScene* diagram = qobject_cast<DiagramScene*>(scene());
+    if (diagram && !graph_)
+    {
+      graph_ = &diagram->graph();
+      id_ = graph_->addNode(this, pos());
+      Detached* state = detached();
+      graph_->setText(id_, state->text);
+      graph_->setTextColor(id_, state->textColor);
+      graph_->setOutlineColor(id_, state->outlineColor);
+      graph_->setBackgroundColor(id_, state->backgroundColor);
+      graph_->setZValue(id_, zValue());
+      delete detached_;
+      detached_ = 0;
+    }
+    if (diagram && isSelected())
+      diagram->nodeSelectionChanged(this, true);
   }
   return QGraphicsItem::itemChange(change, value);
 }
 
 void Node::mouseDoubleClickEvent(QGraphicsSceneMouseEvent* event)
 {
-  QString text = QInputDialog::getText(event->widget(), tr("Edit Text"), tr("Enter new text:"), QLineEdit::Normal, text_);
+  QString text = QInputDialog::getText(event->widget(), tr("Edit Text"), tr("Enter new text:"), QLineEdit::Normal, text());
   if (!text.isEmpty())
     setText(text);
 }
@@ -2,8 +2,10 @@
 #define DIAGRAMNODE_H
 
 #include <QGraphicsItem>
+#include <QRgb>
 
 class Link;
+class Graph;
 
 class Node : public QGraphicsItem
 {
@@ -21,8 +23,9 @@ public:
   void setBackgroundColor(const QColor& color);
   QColor backgroundColor() const;
 
-  void addLink(Link* link);
-  void removeLink(Link* link);
+  Graph* graph() const;
+  int id() const;
+  QList<Link*> links() const;
 
   QRectF boundingRect() const;
   QPainterPath shape() const;
@@ -33,14 +36,31 @@ protected:
   QVariant itemChange(GraphicsItemChange change, const QVariant& value);
 
 private:
+  friend class DiagramScene;
+
+  void attach(Graph* graph, int id);
+  void detach();
   QRectF outlineRect() const;
   int roundness(double size) const;
+  void paintFrame(QPainter* painter, const QRectF& rect, bool selected) const;
+  QPixmap framePixmap(const QRectF& rect, bool selected, qreal levelOfDetail) const;
+
+  // What the node shows until it has a record in a graph; from then on the
+  // record is the only copy.
+  struct Detached
+  {
+    QString text;
+    QRgb textColor;
+    QRgb outlineColor;
+    QRgb backgroundColor;
+  };
+
+  Detached* detached();
+  void markModified();
 
-  QSet<Link*> links_;
-  QString text_;
-  QColor textColor_;
-  QColor backgroundColor_;
-  QColor outlineColor_;
+  Graph* graph_;
+  int id_;
+  Detached* detached_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,12 @@
+#include "RenderStats.h"
+
+QAtomicInt RenderStats::nodesPainted_(0);
+QAtomicInt RenderStats::linksPainted_(0);
+QAtomicInt RenderStats::indexUpdates_(0);
+
+void RenderStats::reset()
+{
+  takeNodesPainted();
+  takeLinksPainted();
+  takeIndexUpdates();
+}
@@ -0,0 +1,26 @@
+#ifndef DIAGRAMRENDERSTATS_H
+#define DIAGRAMRENDERSTATS_H
+
+#include <QAtomicInt>
+
+// Process-wide counters bumped by the items while they paint and move.
+// Whoever measures a frame takes the counts and resets them.
+class RenderStats
+{
+public:
+  static void nodePainted() { nodesPainted_.ref(); }
+  static void linkPainted() { linksPainted_.ref(); }
+  static void indexUpdated() { indexUpdates_.ref(); }
+
+  static int takeNodesPainted() { return nodesPainted_.fetchAndStoreRelaxed(0); }
+  static int takeLinksPainted() { return linksPainted_.fetchAndStoreRelaxed(0); }
+  static int takeIndexUpdates() { return indexUpdates_.fetchAndStoreRelaxed(0); }
+  static void reset();
+
+private:
+  static QAtomicInt nodesPainted_;
+  static QAtomicInt linksPainted_;
+  static QAtomicInt indexUpdates_;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <QtGui>
+#include <algorithm>
+#include "StackingOrder.h"
+#include "Graph.h"
+#include "Node.h"
+
+static const double ZLimit = 1e12;
+// Renumbered values start half way up, leaving as much room below for
+// Send to Back as above for Bring to Front.
+static const double ZBase = ZLimit / 2;
+
+StackingOrder::StackingOrder(Graph* graph)
+{
+  graph_ = graph;
+  rebuild();
+}
+
+void StackingOrder::raiseToFront(const QVector<int>& nodes)
+{
+  place(nodes, -1, true);
+}
+
+void StackingOrder::lowerToBack(const QVector<int>& nodes)
+{
+  place(nodes, -1, false);
+}
+
+void StackingOrder::placeAbove(const QVector<int>& nodes, int target)
+{
+  place(nodes, target, true);
+}
+
+void StackingOrder::placeBelow(const QVector<int>& nodes, int target)
+{
+  place(nodes, target, false);
+}
+
+// Patches in the nodes added, removed or given new z values by somebody
+// else since the last restacking. Link changes do not touch the order.
+void StackingOrder::sync()
+{
+  QVector<Graph::ZChange> changes;
+  if (!graph_->takeZChanges(&changes))
+  {
+    rebuild();
+    return;
+  }
+
+  foreach (const Graph::ZChange& change, changes)
+  {
+    Entry entry;
+    entry.z = change.z;
+    entry.node = change.node;
+    QVector<Entry>::iterator i = std::lower_bound(entries_.begin(), entries_.end(), entry);
+    if (change.added)
+      entries_.insert(i, entry);
+    else if (i != entries_.end() && i->node == entry.node && i->z == entry.z)
+      entries_.erase(i);
+  }
+}
+
+void StackingOrder::rebuild()
+{
+  graph_->takeZChanges(0);
+  entries_.clear();
+  entries_.reserve(graph_->nodeCount());
+  for (int i = 0; i < graph_->nodeCapacity(); ++i)
+  {
+    if (graph_->hasNode(i))
+    {
+      Entry entry;
+      entry.z = graph_->zValue(i);
+      entry.node = i;
+      entries_.append(entry);
+    }
+  }
+  std::sort(entries_.begin(), entries_.end());
+}
+
+// Moves the nodes, in their current relative order, just above or below
+// target, or to the front or back when target is -1.
+void StackingOrder::place(const QVector<int>& nodes, int target, bool above)
+{
+  sync();
+
+  QSet<int> moving;
+  foreach (int node, nodes)
+  {
+    if (node != target)
+      moving.insert(node);
+  }
+  if (moving.isEmpty())
+    return;
+
+  QVector<Entry> moved;
+  int kept = 0;
+  for (int i = 0; i < entries_.count(); ++i)
+  {
+    if (moving.contains(entries_[i].node))
+      moved.append(entries_[i]);
+    else
+      entries_[kept++] = entries_[i];
+  }
+  entries_.resize(kept);
+
+  int position;
+  if (target < 0)
+    position = above ? entries_.count() : 0;
+  else
+    position = indexOf(target) + (above ? 1 : 0);
+
+  int count = moved.count();
+  double low, high;
+  if (position > 0 && position < entries_.count())
+  {
+    low = entries_[position - 1].z;
+    high = entries_[position].z;
+  }
+  else if (position > 0)
+  {
+    low = entries_[position - 1].z;
+    high = qMin(ZLimit, low + double(Gap) * (count + 1));
+  }
+  else if (position < entries_.count())
+  {
+    high = entries_[position].z;
+    low = qMax(0.0, high - double(Gap) * (count + 1));
+  }
+  else
+  {
+    low = ZBase;
+    high = ZBase + double(Gap) * (count + 1);
+  }
+
+  // Near either end the remaining interval is split before falling back
+  // to a renumber.
+  entries_.insert(position, count, Entry());
+  double step = qFloor((high - low) / (count + 1));
+  if (step >= 1 && high <= ZLimit)
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      entries_[position + i].node = moved[i].node;
+      setZ(position + i, low + step * (i + 1));
+    }
+  }
+  else
+  {
+    for (int i = 0; i < count; ++i)
+      entries_[position + i] = moved[i];
+    renumber();
+  }
+  // The log now holds only this restacking, which the array already shows.
+  graph_->takeZChanges(0);
+}
+
+int StackingOrder::indexOf(int node) const
+{
+  Entry key;
+  key.z = graph_->zValue(node);
+  key.node = node;
+  return std::lower_bound(entries_.begin(), entries_.end(), key) - entries_.begin();
+}
+
+void StackingOrder::renumber()
+{
+  for (int i = 0; i < entries_.count(); ++i)
+  {
+    double z = ZBase + double(Gap) * (i + 1);
+    if (entries_[i].z != z)
+      setZ(i, z);
+  }
+}
+
+// Nodes with an item are restacked through it so that the scene learns
+// about the change; records in a virtualized scene are updated directly.
+void StackingOrder::setZ(int index, double z)
+{
+  Entry& entry = entries_[index];
+  entry.z = z;
+  Node* item = graph_->node(entry.node);
+  if (item)
+    item->setZValue(z);
+  else
+    graph_->setZValue(entry.node, z);
+}
@@ -0,0 +1,51 @@
+#ifndef DIAGRAMSTACKINGORDER_H
+#define DIAGRAMSTACKINGORDER_H
+
+#include <QVector>
+
+class Graph;
+
+// Stacking order of the nodes of a graph, kept as an array of (z, node)
+// pairs sorted by z. Restacked nodes take fresh z values from the gap
+// between their new neighbours, so a move touches only the moved nodes.
+// When a gap is used up, or values reach 0 or ZLimit, the whole order is
+// renumbered Gap apart from the middle of that range in one pass without
+// changing anybody's rank. Node z values stay positive, above the links.
+// Nodes added, removed or restacked by somebody else are found in the
+// graph's log of z changes and put in place by binary search.
+class StackingOrder
+{
+public:
+  enum { Gap = 1024 };
+
+  StackingOrder(Graph* graph);
+
+  void raiseToFront(const QVector<int>& nodes);
+  void lowerToBack(const QVector<int>& nodes);
+  void placeAbove(const QVector<int>& nodes, int target);
+  void placeBelow(const QVector<int>& nodes, int target);
+
+private:
+  struct Entry
+  {
+    double z;
+    int node;
+
+    bool operator<(const Entry& other) const
+    {
+      return z < other.z || (z == other.z && node < other.node);
+    }
+  };
+
+  void sync();
+  void rebuild();
+  void place(const QVector<int>& nodes, int target, bool above);
+  int indexOf(int node) const;
+  void renumber();
+  void setZ(int index, double z);
+
+  Graph* graph_;
+  QVector<Entry> entries_;
+};
+
+#endif
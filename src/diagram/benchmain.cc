@@ -0,0 +1,196 @@
+#include <QtGui>
+#include "DiagramScene.h"
+#include "DiagramView.h"
+#include "Node.h"
+#include "Link.h"
+#include "RenderStats.h"
+
+struct PhaseResult
+{
+	PhaseResult() : frames(0), totalNs(0), maxNs(0), nodesPainted(0), linksPainted(0), indexUpdates(0) {}
+
+	int frames;
+	qint64 totalNs;
+	qint64 maxNs;
+	qint64 nodesPainted;
+	qint64 linksPainted;
+	qint64 indexUpdates;
+};
+
+static void buildDiagram(DiagramScene* scene, int nodeCount, int degree)
+{
+	const int Columns = qMax(1, int(qSqrt(nodeCount)));
+	const int Neighbourhood = 3 * Columns;
+
+	qsrand(1);
+	scene->setItemIndexMethod(QGraphicsScene::NoIndex);
+	scene->graph().reserve(nodeCount, nodeCount * degree);
+
+	QVector<Node*> nodes(nodeCount);
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		Node* node = new Node;
+		node->setText(QString("Node %1").arg(i + 1));
+		node->setPos(80 + 100 * (i % Columns), 80 + 50 * (i / Columns));
+		node->setZValue(i);
+		scene->addItem(node);
+		nodes[i] = node;
+	}
+
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		for (int j = 0; j < degree; ++j)
+		{
+			// Wrapped around so the last nodes get as many links as the rest.
+			int other = (i + 1 + qrand() % Neighbourhood) % nodeCount;
+			if (other != i)
+				scene->addItem(new Link(nodes[i], nodes[other]));
+		}
+	}
+
+	scene->setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+	scene->setSceneRect(scene->itemsBoundingRect());
+}
+
+// Renders the view and books the frame, counting from when the timer was
+// started so that the work that led to the frame is included. Frames are
+// often shorter than a millisecond, so they are timed in nanoseconds.
+static void finishFrame(QGraphicsView* view, QImage* image, const QElapsedTimer& timer, PhaseResult* result)
+{
+	{
+		QPainter painter(image);
+		view->render(&painter);
+	}
+	qint64 ns = timer.nsecsElapsed();
+
+	++result->frames;
+	result->totalNs += ns;
+	result->maxNs = qMax(result->maxNs, ns);
+	result->nodesPainted += RenderStats::takeNodesPainted();
+	result->linksPainted += RenderStats::takeLinksPainted();
+	result->indexUpdates += RenderStats::takeIndexUpdates();
+}
+
+static void report(QTextStream& out, const QString& name, const PhaseResult& result)
+{
+	int frames = qMax(1, result.frames);
+	out << qSetFieldWidth(14) << left << name << qSetFieldWidth(0)
+	    << QString("%1 ms/frame (max %2), %3 nodes + %4 links painted/frame, %5 index updates/frame")
+	       .arg(result.totalNs / 1e6 / frames, 0, 'f', 3)
+	       .arg(result.maxNs / 1e6, 0, 'f', 3)
+	       .arg(result.nodesPainted / frames)
+	       .arg(result.linksPainted / frames)
+	       .arg(result.indexUpdates / frames)
+	    << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	QApplication app(argc, argv);
+	QTextStream out(stdout);
+
+	int nodeCount = 10000;
+	int degree = 2;
+	int frames = 50;
+	bool virtualScene = false;
+	QSize viewSize(1280, 800);
+
+	QStringList args = app.arguments();
+	for (int i = 1; i < args.count(); i += 2)
+	{
+		if (args[i] == "--virtual")
+		{
+			virtualScene = true;
+			--i;
+		}
+		else if (i + 1 == args.count())
+			break;
+		else if (args[i] == "--nodes")
+			nodeCount = qMax(1, args[i + 1].toInt());
+		else if (args[i] == "--degree")
+			degree = qMax(0, args[i + 1].toInt());
+		else if (args[i] == "--frames")
+			frames = qMax(1, args[i + 1].toInt());
+		else if (args[i] == "--cache-limit")
+			QPixmapCache::setCacheLimit(qMax(0, args[i + 1].toInt()));
+		else if (args[i] == "--size")
+		{
+			QStringList parts = args[i + 1].split('x');
+			if (parts.count() == 2)
+				viewSize = QSize(parts[0].toInt(), parts[1].toInt());
+		}
+	}
+
+	DiagramScene scene(0, 0, 600, 500);
+	QElapsedTimer buildTimer;
+	buildTimer.start();
+	buildDiagram(&scene, nodeCount, degree);
+	out << "Built " << scene.graph().nodeCount() << " nodes and " << scene.graph().linkCount()
+	    << " links in " << buildTimer.elapsed() << " ms" << endl;
+
+	// The view is laid out and painted like a visible one, but never reaches the screen.
+	DiagramView view;
+	view.setScene(&scene);
+	view.setAttribute(Qt::WA_DontShowOnScreen);
+	view.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+	view.resize(viewSize);
+	view.show();
+	app.processEvents();
+	if (virtualScene)
+	{
+		scene.setVirtualized(true);
+		view.updateVisibleRegion();
+		out << "Virtual scene, " << scene.items().count() << " items in view" << endl;
+	}
+
+	QImage image(view.viewport()->size(), QImage::Format_ARGB32_Premultiplied);
+	QRectF bounds = scene.sceneRect();
+	RenderStats::reset();
+
+	QElapsedTimer timer;
+	PhaseResult pan;
+	for (int i = 0; i < frames; ++i)
+	{
+		qreal t = qreal(i) / frames;
+		timer.start();
+		view.centerOn(bounds.left() + t * bounds.width(), bounds.top() + t * bounds.height());
+		finishFrame(&view, &image, timer, &pan);
+	}
+
+	view.centerOn(bounds.center());
+	QRectF visible = view.mapToScene(view.viewport()->rect()).boundingRect();
+	QPainterPath visibleArea;
+	visibleArea.addRect(visible);
+	scene.setSelectionArea(visibleArea);
+	QList<Node*> dragged = scene.selectedNodes();
+	RenderStats::reset();
+
+	PhaseResult drag;
+	for (int i = 0; i < frames; ++i)
+	{
+		timer.start();
+		foreach (Node* node, dragged)
+			node->moveBy(1, 1);
+		finishFrame(&view, &image, timer, &drag);
+	}
+	scene.clearSelection();
+	RenderStats::reset();
+
+	PhaseResult rubberBand;
+	for (int i = 0; i < frames; ++i)
+	{
+		qreal t = qreal(i + 1) / frames;
+		QPainterPath band;
+		band.addRect(QRectF(visible.topLeft(), visible.size() * t));
+		timer.start();
+		scene.setSelectionArea(band);
+		finishFrame(&view, &image, timer, &rubberBand);
+	}
+
+	out << "View " << viewSize.width() << "x" << viewSize.height() << ", "
+	    << dragged.count() << " nodes dragged" << endl;
+	report(out, "pan", pan);
+	report(out, "drag", drag);
+	report(out, "rubber band", rubberBand);
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <QApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+#include "DiagramScene.h"
+#include "DiagramDocument.h"
+#include "DiagramExporter.h"
+
+static int usage(QTextStream& err)
+{
+	err << "Usage: diagramexport [--scale S] [--tile-size N] [--threads N] input.dgm output.png|svg|pdf" << endl;
+	err << "PNG output is written as tiles named output_<row>_<column>.png." << endl;
+	return 2;
+}
+
+int main(int argc, char* argv[])
+{
+	// No window system is needed: everything is painted on QImage, SVG or PDF devices.
+	QApplication app(argc, argv, false);
+	QTextStream out(stdout);
+	QTextStream err(stderr);
+
+	qreal scale = 1.0;
+	int tileSize = 2048;
+	int threads = QThread::idealThreadCount();
+	QStringList files;
+
+	QStringList args = app.arguments();
+	for (int i = 1; i < args.count(); ++i)
+	{
+		bool ok = true;
+		if (args[i] == "--scale" && i + 1 < args.count())
+			scale = args[++i].toDouble(&ok);
+		else if (args[i] == "--tile-size" && i + 1 < args.count())
+			tileSize = args[++i].toInt(&ok);
+		else if (args[i] == "--threads" && i + 1 < args.count())
+			threads = args[++i].toInt(&ok);
+		else if (args[i].startsWith("--"))
+			return usage(err);
+		else
+			files.append(args[i]);
+		if (!ok)
+			return usage(err);
+	}
+	if (files.count() != 2 || scale <= 0 || tileSize <= 0)
+		return usage(err);
+
+	QFile file(files[0]);
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		err << "Cannot read file " << file.fileName() << ": " << file.errorString() << endl;
+		return 1;
+	}
+
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_4_7);
+
+	quint32 magic;
+	in >> magic;
+	if (magic != DiagramMagicNumber)
+	{
+		err << file.fileName() << " is not a Diagram file." << endl;
+		return 1;
+	}
+
+	DiagramScene scene(0, 0, 600, 500);
+	DiagramReader reader(in, &scene);
+	if (reader.readHeader())
+	{
+		while (!reader.atEnd() && reader.readChunk())
+			;
+	}
+	reader.finish();
+	if (reader.hasError())
+	{
+		err << "The file " << file.fileName() << " is corrupt." << endl;
+		return 1;
+	}
+
+	DiagramExporter exporter(&scene);
+	exporter.setScale(scale);
+	exporter.setTileSize(tileSize);
+	exporter.setThreadCount(threads);
+
+	QString suffix = QFileInfo(files[1]).suffix().toLower();
+	bool ok;
+	if (suffix == "svg")
+		ok = exporter.exportSvg(files[1]);
+	else if (suffix == "pdf")
+		ok = exporter.exportPdf(files[1]);
+	else
+	{
+		ok = exporter.exportTiles(files[1]);
+		out << exporter.tilesRendered() << " tiles rendered, "
+		    << exporter.tilesReused() << " unchanged" << endl;
+	}
+
+	if (!ok)
+	{
+		err << exporter.errorString() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -6,5 +6,7 @@ int main(int argc, char* argv[])
 	QApplication app(argc, argv);
 	DiagramWindow window;
 	window.show();
+	if (app.arguments().count() > 1)
+		window.loadFile(app.arguments().at(1));
 	return app.exec();
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include <QtCore>
+#include "cellarena.h"
+
+static const int BlockChars = CellArena::BlockSize / sizeof(QChar);
+static const int LargeText = BlockChars / 4;
+
+CellArena::CellArena()
+{
+	slotSize = 0;
+	cellBlocksUsed = 0;
+	cellCursor = 0;
+	cellEnd = 0;
+	freeSlots = 0;
+	textBlocksUsed = 0;
+	textCursor = 0;
+	textEnd = 0;
+	freeTexts.fill(0, LargeText / TextGranule + 1);
+}
+
+CellArena::~CellArena()
+{
+	clear();
+	foreach (char* block, cellBlocks)
+		qFree(block);
+	foreach (char* block, textBlocks)
+		qFree(block);
+}
+
+// Every allocation has the same size, that of the first one, so a freed
+// slot can take any later cell.
+void* CellArena::allocate(size_t size)
+{
+	if (slotSize == 0)
+		slotSize = qMax((size + 15) & ~size_t(15), sizeof(FreeSlot));
+	Q_ASSERT(size <= slotSize);
+	
+	if (freeSlots)
+	{
+		void* p = freeSlots;
+		freeSlots = freeSlots->next;
+		return p;
+	}
+	if (cellCursor + slotSize > cellEnd)
+	{
+		cellCursor = newBlock(cellBlocks, cellBlocksUsed);
+		cellEnd = cellCursor + BlockSize;
+	}
+	void* p = cellCursor;
+	cellCursor += slotSize;
+	return p;
+}
+
+void CellArena::release(void* p)
+{
+	FreeSlot* slot = static_cast<FreeSlot*>(p);
+	slot->next = freeSlots;
+	freeSlots = slot;
+}
+
+// Returns a copy of the characters of text that stays valid until it is
+// released or clear() is called. Lengths are rounded up to TextGranule,
+// which keeps every slot aligned for a FreeSlot. Strings too long to share
+// a block get one of their own.
+const QChar* CellArena::storeText(const QString& text)
+{
+	int length = text.size();
+	if (length == 0)
+		return 0;
+	
+	QChar* chars;
+	if (length > LargeText)
+	{
+		chars = static_cast<QChar*>(qMalloc(length * sizeof(QChar)));
+		largeTexts.insert(chars);
+	}
+	else
+	{
+		int sizeClass = (length + TextGranule - 1) / TextGranule;
+		if (freeTexts[sizeClass])
+		{
+			chars = reinterpret_cast<QChar*>(freeTexts[sizeClass]);
+			freeTexts[sizeClass] = freeTexts[sizeClass]->next;
+		}
+		else
+		{
+			int size = sizeClass * TextGranule;
+			if (textCursor + size > textEnd)
+			{
+				textCursor = reinterpret_cast<QChar*>(newBlock(textBlocks, textBlocksUsed));
+				textEnd = textCursor + BlockChars;
+			}
+			chars = textCursor;
+			textCursor += size;
+		}
+	}
+	memcpy(chars, text.unicode(), length * sizeof(QChar));
+	return chars;
+}
+
+void CellArena::releaseText(const QChar* chars, int length)
+{
+	if (length == 0)
+		return;
+	
+	QChar* p = const_cast<QChar*>(chars);
+	if (length > LargeText)
+	{
+		largeTexts.remove(p);
+		qFree(p);
+	}
+	else
+	{
+		int sizeClass = (length + TextGranule - 1) / TextGranule;
+		FreeSlot* slot = reinterpret_cast<FreeSlot*>(p);
+		slot->next = freeTexts[sizeClass];
+		freeTexts[sizeClass] = slot;
+	}
+}
+
+// Blocks are kept for the next fill of the sheet rather than returned to
+// the heap; only oversized strings are freed.
+void CellArena::clear()
+{
+	cellBlocksUsed = 0;
+	cellCursor = 0;
+	cellEnd = 0;
+	freeSlots = 0;
+	
+	textBlocksUsed = 0;
+	textCursor = 0;
+	textEnd = 0;
+	freeTexts.fill(0);
+	foreach (QChar* chars, largeTexts)
+		qFree(chars);
+	largeTexts.clear();
+}
+
+char* CellArena::newBlock(QList<char*>& blocks, int& used)
+{
+	if (used == blocks.count())
+		blocks.append(static_cast<char*>(qMalloc(BlockSize)));
+	return blocks[used++];
+}
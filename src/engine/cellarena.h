@@ -0,0 +1,54 @@
+#ifndef CELLARENA_H
+#define CELLARENA_H
+
+#include <QChar>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// Storage for the cells of one sheet and the text of their formulas. Both
+// are carved out of large blocks, so filling a sheet costs a handful of
+// allocations. Freed cells go on a free list, and freed text on one free
+// list per size class, so editing a cell over and over reuses the same
+// few slots. clear() recycles every block at once, which requires that no
+// cell allocated from the arena is still alive.
+class CellArena
+{
+public:
+	enum { BlockSize = 64 * 1024, TextGranule = 8 };
+	
+	CellArena();
+	~CellArena();
+	void* allocate(size_t size);
+	void release(void* p);
+	const QChar* storeText(const QString& text);
+	void releaseText(const QChar* chars, int length);
+	void clear();
+private:
+	CellArena(const CellArena&);
+	CellArena& operator=(const CellArena&);
+	
+	char* newBlock(QList<char*>& blocks, int& used);
+	
+	struct FreeSlot
+	{
+		FreeSlot* next;
+	};
+	
+	size_t slotSize;
+	QList<char*> cellBlocks;
+	int cellBlocksUsed;
+	char* cellCursor;
+	char* cellEnd;
+	FreeSlot* freeSlots;
+	
+	QList<char*> textBlocks;
+	int textBlocksUsed;
+	QChar* textCursor;
+	QChar* textEnd;
+	QVector<FreeSlot*> freeTexts;
+	QSet<QChar*> largeTexts;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include <QtCore>
+#include <limits>
+#include "cyclesolver.h"
+#include "lookupindex.h"
+#include "rangeindex.h"
+
+CycleSolver::CycleSolver(int rowCount, int columnCount)
+{
+	this->rowCount = rowCount;
+	this->columnCount = columnCount;
+	maxIterations = 100;
+	tolerance = 0.001;
+}
+
+// A start value that is not a number, such as the circular reference error
+// the cell held before, starts the iteration from 0.
+void CycleSolver::addCell(int row, int column, const Formula* formula, const Value& start)
+{
+	members.insert(column * rowCount + row, cells.count());
+	cells.append(QPoint(column, row));
+	formulas.append(formula);
+	values.append(start.isError() ? Value(0.0) : start);
+}
+
+void CycleSolver::setOutsideValue(int row, int column, const Value& value)
+{
+	outside.insert(column * rowCount + row, value);
+}
+
+void CycleSolver::setLimits(int maxIterations, double tolerance)
+{
+	this->maxIterations = maxIterations;
+	this->tolerance = tolerance;
+}
+
+// Returns false if the values still moved after the last sweep; they are
+// then left as that sweep made them.
+bool CycleSolver::solve()
+{
+	for (int sweep = 0; sweep < maxIterations; ++sweep)
+	{
+		double change = 0.0;
+		for (int i = 0; i < cells.count(); ++i)
+		{
+			Value value = formulas[i]->evaluate(*this, cells[i].y(), cells[i].x());
+			if (value.isNumber() && values[i].isNumber())
+				change = qMax(change, qAbs(value.toNumber() - values[i].toNumber()));
+			else if (value != values[i])
+				change = std::numeric_limits<double>::infinity();
+			values[i] = value;
+		}
+		if (change <= tolerance)
+			return true;
+	}
+	return false;
+}
+
+Value CycleSolver::cellValue(int row, int column) const
+{
+	int id = column * rowCount + row;
+	QHash<int, int>::const_iterator i = members.constFind(id);
+	if (i != members.constEnd())
+		return values[i.value()];
+	return outside.value(id, Value(0.0));
+}
+
+// Only the members and the cells copied in from outside hold values.
+bool CycleSolver::storedValue(int row, int column, Value* value) const
+{
+	int id = column * rowCount + row;
+	if (!members.contains(id) && !outside.contains(id))
+		return false;
+	*value = cellValue(row, column);
+	return true;
+}
+
+RangeTotals CycleSolver::rangeTotals(int top, int left, int bottom, int right) const
+{
+	return RangeIndex::scan(this, rowCount, columnCount, top, left, bottom, right);
+}
+
+int CycleSolver::match(const Value& key, int top, int left, int bottom, int right, int type) const
+{
+	return LookupIndex::scan(this, rowCount, columnCount, key, top, left, bottom, right, type);
+}
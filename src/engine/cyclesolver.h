@@ -0,0 +1,48 @@
+#ifndef CYCLESOLVER_H
+#define CYCLESOLVER_H
+
+#include <QHash>
+#include <QPoint>
+#include <QVector>
+#include "formula.h"
+
+// One circular group of formulas, solved by Gauss-Seidel sweeps: each
+// sweep evaluates the cells in turn, every cell reading the newest values
+// of the others, until no value moves by more than the tolerance. The
+// values of the cells the group reads from outside are copied in, so
+// independent groups can be solved on different threads.
+class CycleSolver : public EvalContext, private ValueSource
+{
+public:
+	CycleSolver(int rowCount = 0, int columnCount = 0);
+	
+	void addCell(int row, int column, const Formula* formula, const Value& start);
+	void setOutsideValue(int row, int column, const Value& value);
+	void setLimits(int maxIterations, double tolerance);
+	void setVolatileState(const VolatileState& state) { volatiles = state; }
+	bool solve();
+	
+	int cellCount() const { return cells.count(); }
+	QPoint cell(int i) const { return cells[i]; }
+	Value value(int i) const { return values[i]; }
+	
+	Value cellValue(int row, int column) const;
+	RangeTotals rangeTotals(int top, int left, int bottom, int right) const;
+	int match(const Value& key, int top, int left, int bottom, int right, int type) const;
+	VolatileState volatileState() const { return volatiles; }
+private:
+	bool storedValue(int row, int column, Value* value) const;
+	
+	int rowCount;
+	int columnCount;
+	int maxIterations;
+	double tolerance;
+	QVector<QPoint> cells;
+	QVector<const Formula*> formulas;
+	QVector<Value> values;
+	QHash<int, int> members;
+	QHash<int, Value> outside;
+	VolatileState volatiles;
+};
+
+#endif
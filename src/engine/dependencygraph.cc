@@ -0,0 +1,234 @@
+#include <QtCore>
+#include "dependencygraph.h"
+
+namespace
+{
+	struct Frame
+	{
+		int cell;
+		QVector<int> next;
+		int position;
+	};
+}
+
+DependencyGraph::DependencyGraph(int rowCount, int columnCount)
+{
+	this->rowCount = rowCount;
+	this->columnCount = columnCount;
+	columnReaders.resize(columnCount);
+}
+
+// The ranges of a cell are filed column by column, all of them for one
+// column together, so dependents() can tell a reader whose ranges overlap
+// from the entry before.
+void DependencyGraph::setPrecedents(int cell, const QVector<QRect>& precedents)
+{
+	foreach (const QRect& rect, precedentsOf.value(cell))
+	{
+		if (rect.width() == 1 && rect.height() == 1)
+		{
+			QHash<int, QVector<int> >::iterator i = readers.find(id(rect.y(), rect.x()));
+			if (i != readers.end() && i.value().contains(cell))
+			{
+				i.value().remove(i.value().indexOf(cell));
+				if (i.value().isEmpty())
+					readers.erase(i);
+			}
+		}
+		else
+		{
+			for (int column = qMax(rect.left(), 0); column <= qMin(rect.right(), columnCount - 1); ++column)
+			{
+				QVector<RangeReader>& entries = columnReaders[column];
+				int kept = 0;
+				for (int j = 0; j < entries.count(); ++j)
+				{
+					if (entries[j].cell != cell)
+						entries[kept++] = entries[j];
+				}
+				entries.resize(kept);
+			}
+		}
+	}
+	precedentsOf.remove(cell);
+	
+	QVector<QRect> ranges;
+	int left = columnCount;
+	int right = -1;
+	foreach (const QRect& rect, precedents)
+	{
+		if (rect.width() == 1 && rect.height() == 1)
+		{
+			if (contains(rect, id(rect.y(), rect.x())))
+				readers[id(rect.y(), rect.x())].append(cell);
+		}
+		else
+		{
+			ranges.append(rect);
+			left = qMin(left, qMax(rect.left(), 0));
+			right = qMax(right, qMin(rect.right(), columnCount - 1));
+		}
+	}
+	for (int column = left; column <= right; ++column)
+	{
+		foreach (const QRect& rect, ranges)
+		{
+			if (rect.left() <= column && column <= rect.right())
+			{
+				RangeReader entry;
+				entry.cell = cell;
+				entry.top = rect.top();
+				entry.bottom = rect.bottom();
+				columnReaders[column].append(entry);
+			}
+		}
+	}
+	if (!precedents.isEmpty())
+		precedentsOf.insert(cell, precedents);
+}
+
+void DependencyGraph::clear()
+{
+	readers.clear();
+	for (int column = 0; column < columnCount; ++column)
+		columnReaders[column].clear();
+	precedentsOf.clear();
+}
+
+// The cells that read cell directly.
+QVector<int> DependencyGraph::dependents(int cell) const
+{
+	QVector<int> result = readers.value(cell);
+	if (cell < 0 || cell >= rowCount * columnCount)
+		return result;
+	
+	int r = row(cell);
+	foreach (const RangeReader& entry, columnReaders[column(cell)])
+	{
+		if (entry.top <= r && r <= entry.bottom && (result.isEmpty() || result.last() != entry.cell))
+			result.append(entry.cell);
+	}
+	return result;
+}
+
+// Every cell that reads cell directly or through other cells, in id
+// order. A cell on a cycle through cell is included; cell itself is not
+// unless it is on such a cycle.
+QVector<int> DependencyGraph::cone(int cell) const
+{
+	return cone(QVector<int>() << cell);
+}
+
+// The union of the cones of cells, each dependent visited once however
+// many of the cells it reads.
+QVector<int> DependencyGraph::cone(const QVector<int>& cells) const
+{
+	QSet<int> visited;
+	QVector<int> pending;
+	foreach (int cell, cells)
+		pending += dependents(cell);
+	while (!pending.isEmpty())
+	{
+		int next = pending.last();
+		pending.pop_back();
+		if (visited.contains(next))
+			continue;
+		visited.insert(next);
+		pending += dependents(next);
+	}
+	
+	QVector<int> result;
+	result.reserve(visited.count());
+	foreach (int dependent, visited)
+		result.append(dependent);
+	qSort(result);
+	return result;
+}
+
+// The strongly connected components of the formula cells, by Tarjan's
+// algorithm, with every component after those it reads from. A component
+// of more than one cell, or of a cell that reads itself, is a cycle.
+QVector<QVector<int> > DependencyGraph::components() const
+{
+	return components(precedentsOf.keys().toVector());
+}
+
+// The components of cells and of everything that depends on them, in the
+// same order; components they cannot reach are not visited. The
+// depth-first search keeps its own stack, as a long chain of references
+// would overflow the call stack.
+QVector<QVector<int> > DependencyGraph::components(const QVector<int>& cells) const
+{
+	QHash<int, int> index;
+	QHash<int, int> low;
+	QVector<int> stack;
+	QSet<int> onStack;
+	QVector<QVector<int> > result;
+	
+	foreach (int cell, cells)
+	{
+		if (index.contains(cell))
+			continue;
+		
+		QVector<Frame> frames;
+		int next = cell;
+		for (;;)
+		{
+			if (next >= 0)
+			{
+				index.insert(next, index.count());
+				low.insert(next, index.value(next));
+				stack.append(next);
+				onStack.insert(next);
+				Frame frame;
+				frame.cell = next;
+				frame.next = dependents(next);
+				frame.position = 0;
+				frames.append(frame);
+				next = -1;
+			}
+			
+			Frame& frame = frames.last();
+			if (frame.position < frame.next.count())
+			{
+				int w = frame.next[frame.position++];
+				if (!index.contains(w))
+					next = w;
+				else if (onStack.contains(w))
+					low[frame.cell] = qMin(low.value(frame.cell), index.value(w));
+				continue;
+			}
+			
+			int v = frame.cell;
+			if (low.value(v) == index.value(v))
+			{
+				QVector<int> component;
+				int w;
+				do
+				{
+					w = stack.last();
+					stack.pop_back();
+					onStack.remove(w);
+					component.append(w);
+				} while (w != v);
+				result.append(component);
+			}
+			frames.pop_back();
+			if (frames.isEmpty())
+				break;
+			low[frames.last().cell] = qMin(low.value(frames.last().cell), low.value(v));
+		}
+	}
+	
+	// Tarjan's algorithm finishes a component after everything that reads it.
+	for (int j = 0; j < result.count() / 2; ++j)
+		qSwap(result[j], result[result.count() - 1 - j]);
+	return result;
+}
+
+bool DependencyGraph::contains(const QRect& rect, int cell) const
+{
+	if (cell < 0 || cell >= rowCount * columnCount)
+		return false;
+	return rect.contains(column(cell), row(cell));
+}
@@ -0,0 +1,46 @@
+#ifndef DEPENDENCYGRAPH_H
+#define DEPENDENCYGRAPH_H
+
+#include <QHash>
+#include <QRect>
+#include <QVector>
+
+// Which cells read which, so that a change only dirties the cells that
+// depend on it. Cells are numbered column by column, which puts the cells
+// of a column run under consecutive ids. Single-cell references are kept
+// in a reverse index; ranges are filed under every column they cover, so
+// finding the readers of a cell only tests the ranges over its column.
+class DependencyGraph
+{
+public:
+	DependencyGraph(int rowCount, int columnCount);
+	
+	int id(int row, int column) const { return column * rowCount + row; }
+	int row(int id) const { return id % rowCount; }
+	int column(int id) const { return id / rowCount; }
+	
+	void setPrecedents(int cell, const QVector<QRect>& precedents);
+	void clear();
+	QVector<int> dependents(int cell) const;
+	QVector<int> cone(int cell) const;
+	QVector<int> cone(const QVector<int>& cells) const;
+	QVector<QVector<int> > components() const;
+	QVector<QVector<int> > components(const QVector<int>& cells) const;
+private:
+	struct RangeReader
+	{
+		int cell;
+		int top;
+		int bottom;
+	};
+	
+	bool contains(const QRect& rect, int cell) const;
+	
+	int rowCount;
+	int columnCount;
+	QHash<int, QVector<int> > readers;
+	QVector<QVector<RangeReader> > columnReaders;
+	QHash<int, QVector<QRect> > precedentsOf;
+};
+
+#endif
@@ -0,0 +1,1117 @@
+#include <QtCore>
+#include "formula.h"
+
+namespace
+{
+	struct OpKey
+	{
+		int code;
+		int left;
+		int right;
+		int range;
+		int type;
+		double number;
+		
+		bool operator==(const OpKey& other) const
+		{
+			return code == other.code && left == other.left && right == other.right
+				&& range == other.range && type == other.type && number == other.number;
+		}
+	};
+	
+	uint qHash(const OpKey& key)
+	{
+		return ::qHash(quint64(key.code) << 48 ^ quint64(key.left) << 24 ^ quint64(key.right))
+			^ ::qHash(key.range << 4 | key.type) ^ ::qHash(QByteArray::fromRawData(
+				reinterpret_cast<const char*>(&key.number), sizeof(key.number)));
+	}
+	
+	bool isReference(const QString& token)
+	{
+		static const QRegExp regExp("[A-Za-z][1-9][0-9]{0,2}");
+		return QRegExp(regExp).exactMatch(token);
+	}
+	
+	int rangeFunction(const QString& name)
+	{
+		static const char* const Names[] = { "SUM", "AVERAGE", "COUNT", "MIN", "MAX" };
+		for (int i = 0; i < int(sizeof(Names) / sizeof(Names[0])); ++i)
+		{
+			if (name.compare(Names[i], Qt::CaseInsensitive) == 0)
+				return i;
+		}
+		return -1;
+	}
+	
+	enum LookupFunction { VLookup, Match, Index };
+	
+	int lookupFunction(const QString& name)
+	{
+		static const char* const Names[] = { "VLOOKUP", "MATCH", "INDEX" };
+		for (int i = 0; i < int(sizeof(Names) / sizeof(Names[0])); ++i)
+		{
+			if (name.compare(Names[i], Qt::CaseInsensitive) == 0)
+				return i;
+		}
+		return -1;
+	}
+	
+	int volatileFunction(const QString& name)
+	{
+		static const char* const Names[] = { "NOW", "RAND" };
+		for (int i = 0; i < int(sizeof(Names) / sizeof(Names[0])); ++i)
+		{
+			if (name.compare(Names[i], Qt::CaseInsensitive) == 0)
+				return i;
+		}
+		return -1;
+	}
+	
+	// How an error is written as a constant, in ErrorCode order, so that a
+	// cell can hold an error value as well as show one.
+	const char* const ErrorNames[] = { "#SYNTAX!", "#DIV/0!", "#VALUE!", "#CIRC!", "#N/A", "#REF!" };
+	
+	quint64 mix(quint64 x)
+	{
+		x += Q_UINT64_C(0x9E3779B97F4A7C15);
+		x = (x ^ (x >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+		x = (x ^ (x >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+		return x ^ (x >> 31);
+	}
+	
+	int operandCount(Formula::OpCode code)
+	{
+		switch (code)
+		{
+		case Formula::Negate:
+		case Formula::Match:
+			return 1;
+		case Formula::Add:
+		case Formula::Subtract:
+		case Formula::Multiply:
+		case Formula::Divide:
+		case Formula::Index:
+			return 2;
+		default:
+			return 0;
+		}
+	}
+	
+	// Recursive descent over the grammar Cell used to interpret directly,
+	// emitting operations instead of values.
+	class Compiler
+	{
+	public:
+		Compiler(const QString& expr, int row, int column)
+			: str(expr), pos(0), row(row), column(column), draws(0), failed(false)
+		{
+		}
+		
+		QVector<Formula::Op> compile()
+		{
+			int root = expression();
+			if (str[pos] != QChar::Null)
+				failed = true;
+			if (failed)
+			{
+				ops.clear();
+				emitted.clear();
+				ranges.clear();
+				root = constant(Value::fromError(Value::SyntaxError));
+			}
+			return liveOps(root);
+		}
+	private:
+		int expression()
+		{
+			int result = term();
+			while (str[pos] == '+' || str[pos] == '-')
+			{
+				Formula::OpCode code = (str[pos] == '+') ? Formula::Add : Formula::Subtract;
+				++pos;
+				result = binary(code, result, term());
+			}
+			return result;
+		}
+		
+		int term()
+		{
+			int result = factor();
+			while (str[pos] == '*' || str[pos] == '/')
+			{
+				Formula::OpCode code = (str[pos] == '*') ? Formula::Multiply : Formula::Divide;
+				++pos;
+				result = binary(code, result, factor());
+			}
+			return result;
+		}
+		
+		int factor()
+		{
+			int result;
+			bool negative = false;
+			
+			if (str[pos] == '-')
+			{
+				negative = true;
+				++pos;
+			}
+			
+			if (str[pos] == '(')
+			{
+				++pos;
+				result = expression();
+				if (str[pos] == ')')
+					++pos;
+				else
+					failed = true;
+			}
+			else if (str[pos] == '#')
+				result = constant(error());
+			else
+			{
+				int start = pos;
+				while (str[pos].isLetterOrNumber() || str[pos] == '.')
+					++pos;
+				QString token = str.mid(start, pos - start);
+				if (str[pos] == '(' && rangeFunction(token) >= 0)
+				{
+					++pos;
+					result = emit(Formula::Aggregate, range(), rangeFunction(token), Value());
+					if (str[pos] == ')')
+						++pos;
+					else
+						failed = true;
+				}
+				else if (str[pos] == '(' && lookupFunction(token) >= 0)
+				{
+					++pos;
+					result = lookup(lookupFunction(token));
+					if (str[pos] == ')')
+						++pos;
+					else
+						failed = true;
+				}
+				else if (str[pos] == '(' && volatileFunction(token) >= 0)
+				{
+					// Every RAND() is a draw of its own, so CSE must not merge them.
+					++pos;
+					int function = volatileFunction(token);
+					result = emit(Formula::Volatile, (function == Formula::Rand) ? draws++ : 0, function, Value());
+					if (str[pos] == ')')
+						++pos;
+					else
+						failed = true;
+				}
+				else if (isReference(token))
+				{
+					int refColumn = token[0].toUpper().unicode() - 'A';
+					int refRow = token.mid(1).toInt() - 1;
+					result = emit(Formula::Reference, refRow - row, refColumn - column, Value());
+				}
+				else
+				{
+					bool ok;
+					double d = token.toDouble(&ok);
+					if (!ok)
+						failed = true;
+					result = constant(d);
+				}
+			}
+			
+			if (negative)
+			{
+				if (ops[result].code == Formula::Constant)
+					result = constant(Formula::negate(ops[result].constant));
+				else
+					result = emit(Formula::Negate, result, -1, Value());
+			}
+			return result;
+		}
+		
+		Value error()
+		{
+			for (int i = 0; i < int(sizeof(ErrorNames) / sizeof(ErrorNames[0])); ++i)
+			{
+				QString name = QLatin1String(ErrorNames[i]);
+				if (str.mid(pos, name.size()).compare(name, Qt::CaseInsensitive) == 0)
+				{
+					pos += name.size();
+					return Value::fromError(Value::ErrorCode(i + 1));
+				}
+			}
+			failed = true;
+			return Value::fromError(Value::SyntaxError);
+		}
+		
+		// Parses "A1:B10" or a single reference and returns the index of the
+		// range, relative to the cell, in ranges.
+		int range()
+		{
+			QPoint corners[2];
+			for (int i = 0; i < 2; ++i)
+			{
+				int start = pos;
+				while (str[pos].isLetterOrNumber())
+					++pos;
+				QString token = str.mid(start, pos - start);
+				if (!isReference(token))
+					failed = true;
+				else
+					corners[i] = QPoint(token[0].toUpper().unicode() - 'A', token.mid(1).toInt() - 1);
+				if (i == 0)
+				{
+					if (str[pos] != ':')
+					{
+						corners[1] = corners[0];
+						break;
+					}
+					++pos;
+				}
+			}
+			
+			Formula::Range r;
+			r.top = qMin(corners[0].y(), corners[1].y()) - row;
+			r.left = qMin(corners[0].x(), corners[1].x()) - column;
+			r.bottom = qMax(corners[0].y(), corners[1].y()) - row;
+			r.right = qMax(corners[0].x(), corners[1].x()) - column;
+			return addRange(r);
+		}
+		
+		int addRange(const Formula::Range& r)
+		{
+			for (int i = 0; i < ranges.count(); ++i)
+			{
+				const Formula::Range& other = ranges[i];
+				if (other.top == r.top && other.left == r.left
+					&& other.bottom == r.bottom && other.right == r.right)
+					return i;
+			}
+			ranges.append(r);
+			return ranges.count() - 1;
+		}
+		
+		// VLOOKUP(key, range, column[, approximate]), MATCH(key, range[, type])
+		// and INDEX(range, row[, column]). VLOOKUP is a MATCH on the first
+		// column of its range feeding an INDEX into the whole range.
+		int lookup(int function)
+		{
+			int key = -1;
+			if (function != Index)
+			{
+				key = expression();
+				separator();
+			}
+			int r = range();
+			
+			if (function == Index)
+			{
+				separator();
+				int rowNumber = expression();
+				int columnNumber = constant(1.0);
+				if (str[pos] == ',')
+				{
+					++pos;
+					columnNumber = expression();
+				}
+				return emit(Formula::Index, rowNumber, columnNumber, Value(), r);
+			}
+			
+			int columnNumber = -1;
+			if (function == VLookup)
+			{
+				separator();
+				columnNumber = expression();
+			}
+			int type = 1;
+			if (str[pos] == ',')
+			{
+				++pos;
+				double d = constantArgument();
+				if (function == VLookup)
+					type = (d != 0.0) ? 1 : 0;
+				else
+					type = (d > 0.0) ? 1 : (d < 0.0) ? -1 : 0;
+			}
+			
+			if (function == Match)
+				return emit(Formula::Match, key, type, Value(), r);
+			
+			Formula::Range first = ranges[r];
+			first.right = first.left;
+			int position = emit(Formula::Match, key, type, Value(), addRange(first));
+			return emit(Formula::Index, position, columnNumber, Value(), r);
+		}
+		
+		void separator()
+		{
+			if (str[pos] == ',')
+				++pos;
+			else
+				failed = true;
+		}
+		
+		double constantArgument()
+		{
+			int result = expression();
+			if (ops[result].code != Formula::Constant || !ops[result].constant.isNumber())
+			{
+				failed = true;
+				return 0.0;
+			}
+			return ops[result].constant.toNumber();
+		}
+		
+		int binary(Formula::OpCode code, int left, int right)
+		{
+			if (ops[left].code == Formula::Constant && ops[right].code == Formula::Constant)
+				return constant(Formula::arithmetic(code, ops[left].constant, ops[right].constant));
+			return emit(code, left, right, Value());
+		}
+		
+		int constant(const Value& value)
+		{
+			return emit(Formula::Constant, -1, -1, value);
+		}
+		
+		// Returns the existing operation if an identical one was emitted
+		// before, which is what shares common sub-expressions.
+		int emit(Formula::OpCode code, int left, int right, const Value& value, int range = -1)
+		{
+			OpKey key;
+			key.code = code;
+			key.left = left;
+			key.right = right;
+			key.range = range;
+			key.type = value.type();
+			key.number = value.isNumber() ? value.toNumber()
+				: value.isString() ? value.stringHandle() : value.errorCode();
+			
+			QHash<OpKey, int>::const_iterator i = emitted.constFind(key);
+			if (i != emitted.constEnd())
+				return i.value();
+			
+			Formula::Op op;
+			op.code = code;
+			op.left = left;
+			op.right = right;
+			op.range = range;
+			op.shared = -1;
+			op.anchorRow = 0;
+			op.anchorColumn = 0;
+			op.constant = value;
+			ops.append(op);
+			emitted.insert(key, ops.count() - 1);
+			return ops.count() - 1;
+		}
+		
+		// Drops the operations that folding left unused and renumbers the
+		// rest, which puts the root last.
+		QVector<Formula::Op> liveOps(int root)
+		{
+			QVector<bool> live(root + 1, false);
+			live[root] = true;
+			for (int i = root; i >= 0; --i)
+			{
+				if (!live[i])
+					continue;
+				const Formula::Op& op = ops[i];
+				if (operandCount(op.code) >= 1)
+					live[op.left] = true;
+				if (operandCount(op.code) == 2)
+					live[op.right] = true;
+			}
+			
+			QVector<int> index(root + 1, -1);
+			QVector<Formula::Op> result;
+			for (int i = 0; i <= root; ++i)
+			{
+				if (!live[i])
+					continue;
+				Formula::Op op = ops[i];
+				if (operandCount(op.code) >= 1)
+					op.left = index[op.left];
+				if (operandCount(op.code) == 2)
+					op.right = index[op.right];
+				index[i] = result.count();
+				result.append(op);
+			}
+			return result;
+		}
+		
+		const QString& str;
+		int pos;
+		int row;
+		int column;
+		int draws;
+		bool failed;
+		QVector<Formula::Op> ops;
+		QHash<OpKey, int> emitted;
+	public:
+		QVector<Formula::Range> ranges;
+	};
+	
+	struct Cache
+	{
+		QMutex mutex;
+		QHash<QString, Formula*> formulas;
+		QHash<QString, int> expressions;
+		QVector<QString> expressionKeys;
+		QVector<int> expressionRefs;
+		QVector<int> freeExpressions;
+	};
+	
+	int internExpression(Cache* c, const QString& key)
+	{
+		QHash<QString, int>::const_iterator i = c->expressions.constFind(key);
+		if (i != c->expressions.constEnd())
+		{
+			++c->expressionRefs[i.value()];
+			return i.value();
+		}
+		
+		int expression;
+		if (c->freeExpressions.isEmpty())
+		{
+			expression = c->expressionKeys.count();
+			c->expressionKeys.append(key);
+			c->expressionRefs.append(1);
+		}
+		else
+		{
+			expression = c->freeExpressions.last();
+			c->freeExpressions.pop_back();
+			c->expressionKeys[expression] = key;
+			c->expressionRefs[expression] = 1;
+		}
+		c->expressions.insert(key, expression);
+		return expression;
+	}
+	
+	void releaseExpression(Cache* c, int expression)
+	{
+		if (--c->expressionRefs[expression] == 0)
+		{
+			c->expressions.remove(c->expressionKeys[expression]);
+			c->expressionKeys[expression] = QString();
+			c->freeExpressions.append(expression);
+		}
+	}
+	
+	// Spells out the sub-expression at op with every reference taken
+	// relative to (row, column).
+	QString spell(const QVector<Formula::Op>& ops, const QVector<Formula::Range>& ranges,
+		int i, int row, int column)
+	{
+		const Formula::Op& op = ops[i];
+		QString str = QString::number(op.code) + ':';
+		if (op.code == Formula::Constant)
+		{
+			if (op.constant.isNumber())
+				return str + 'n' + QString::number(op.constant.toNumber(), 'g', 17);
+			if (op.constant.isString())
+				return str + 's' + QString::number(op.constant.toString().size()) + ':' + op.constant.toString();
+			return str + 'e' + QString::number(op.constant.errorCode());
+		}
+		if (op.code == Formula::Reference)
+			return str + QString("{%1,%2}").arg(op.left - row).arg(op.right - column);
+		if (op.code == Formula::Volatile)
+			return str + QString::number(op.right) + ',' + QString::number(op.left);
+		
+		int range = op.code == Formula::Aggregate ? op.left
+			: (op.code == Formula::Match || op.code == Formula::Index) ? op.range : -1;
+		if (range >= 0)
+		{
+			const Formula::Range& r = ranges[range];
+			str += QString("{%1,%2,%3,%4}").arg(r.top - row).arg(r.left - column)
+				.arg(r.bottom - row).arg(r.right - column);
+		}
+		if (op.code == Formula::Aggregate || op.code == Formula::Match)
+			str += QString::number(op.right);
+		if (operandCount(op.code) >= 1)
+			str += '(' + spell(ops, ranges, op.left, row, column);
+		if (operandCount(op.code) == 2)
+			str += ',' + spell(ops, ranges, op.right, row, column);
+		if (operandCount(op.code) >= 1)
+			str += ')';
+		return str;
+	}
+	
+	// Rewrites every reference as its offset from (row, column). Two
+	// expressions with the same key compile to the same operations. Spaces
+	// go first, as compile() drops them before reading tokens. A literal
+	// brace is doubled so it cannot pass for a reference.
+	QString relativeKey(const QString& text, int row, int column)
+	{
+		QString expr = text;
+		expr.replace(" ", "");
+		
+		QString key;
+		key.reserve(expr.size() + 8);
+		int pos = 0;
+		while (pos < expr.size())
+		{
+			if (!expr[pos].isLetterOrNumber() && expr[pos] != '.')
+			{
+				if (expr[pos] == '{')
+					key += "{{";
+				else
+					key += expr[pos];
+				++pos;
+				continue;
+			}
+			int start = pos;
+			while (pos < expr.size() && (expr[pos].isLetterOrNumber() || expr[pos] == '.'))
+				++pos;
+			QString token = expr.mid(start, pos - start);
+			if (isReference(token))
+			{
+				int refColumn = token[0].toUpper().unicode() - 'A';
+				int refRow = token.mid(1).toInt() - 1;
+				key += QString("{%1,%2}").arg(refRow - row).arg(refColumn - column);
+			}
+			else
+				key += token;
+		}
+		return key;
+	}
+}
+
+Q_GLOBAL_STATIC(Cache, cache)
+
+Formula* Formula::compile(const QString& expr, int row, int column)
+{
+	QString str = expr;
+	str.replace(" ", "");
+	str.append(QChar::Null);
+	
+	Compiler compiler(str, row, column);
+	Formula* formula = new Formula;
+	formula->ops = compiler.compile();
+	formula->ranges = compiler.ranges;
+	foreach (const Op& op, formula->ops)
+		formula->hasVolatiles = formula->hasVolatiles || op.code == Volatile;
+	formula->findSharedOps();
+	return formula;
+}
+
+// The constant an error is written as in a formula, such as #N/A.
+QString Formula::errorLiteral(Value::ErrorCode code)
+{
+	return QLatin1String(ErrorNames[code - 1]);
+}
+
+// Picks the operations worth sharing with other formulas: those that read
+// a range, directly or through an operand, and call no volatile function.
+// Each is keyed by its spelling relative to the first cell it reads, its
+// anchor, so two formulas reading the same cells give the same key and
+// the same anchor wherever they live. FormulaCache interns the keys.
+void Formula::findSharedOps()
+{
+	QVector<bool> readsRange(ops.count(), false);
+	QVector<bool> volatileOp(ops.count(), false);
+	QVector<bool> anchored(ops.count(), false);
+	sharedKeys.fill(QString(), ops.count());
+	for (int i = 0; i < ops.count(); ++i)
+	{
+		Op& op = ops[i];
+		int range = op.code == Aggregate ? op.left : (op.code == Match || op.code == Index) ? op.range : -1;
+		readsRange[i] = range >= 0;
+		volatileOp[i] = op.code == Volatile;
+		if (op.code == Reference)
+		{
+			anchored[i] = true;
+			op.anchorRow = op.left;
+			op.anchorColumn = op.right;
+		}
+		else if (range >= 0)
+		{
+			anchored[i] = true;
+			op.anchorRow = ranges[range].top;
+			op.anchorColumn = ranges[range].left;
+		}
+		
+		for (int k = 0; k < operandCount(op.code); ++k)
+		{
+			int operand = k == 0 ? op.left : op.right;
+			readsRange[i] = readsRange[i] || readsRange[operand];
+			volatileOp[i] = volatileOp[i] || volatileOp[operand];
+			if (!anchored[i] && anchored[operand])
+			{
+				anchored[i] = true;
+				op.anchorRow = ops[operand].anchorRow;
+				op.anchorColumn = ops[operand].anchorColumn;
+			}
+		}
+		
+		if (readsRange[i] && !volatileOp[i])
+		{
+			sharedKeys[i] = spell(ops, ranges, i, op.anchorRow, op.anchorColumn);
+			hasShared = true;
+		}
+	}
+}
+
+// With shared results a first pass goes from the root down and looks up
+// every shared operation still needed; the operands of one that is found
+// are not evaluated unless something else needs them.
+Value Formula::evaluate(const EvalContext& context, int row, int column) const
+{
+	enum { Unneeded, Needed, Known };
+	
+	SharedResults* shared = hasShared ? context.sharedResults() : 0;
+	QVarLengthArray<Value, 32> results(ops.count());
+	QVarLengthArray<char, 32> state(shared ? ops.count() : 0);
+	if (shared)
+	{
+		for (int i = 0; i < ops.count(); ++i)
+			state[i] = Unneeded;
+		state[ops.count() - 1] = Needed;
+		for (int i = ops.count() - 1; i >= 0; --i)
+		{
+			const Op& op = ops[i];
+			if (state[i] != Needed)
+				continue;
+			if (op.shared >= 0 && shared->find(op.shared, row + op.anchorRow, column + op.anchorColumn, &results[i]))
+			{
+				state[i] = Known;
+				continue;
+			}
+			if (operandCount(op.code) >= 1)
+				state[op.left] = Needed;
+			if (operandCount(op.code) == 2)
+				state[op.right] = Needed;
+		}
+	}
+	
+	for (int i = 0; i < ops.count(); ++i)
+	{
+		if (shared && state[i] != Needed)
+			continue;
+		const Op& op = ops[i];
+		results[i] = operation(context, op, row, column, results.constData());
+		if (shared && op.shared >= 0)
+			shared->insert(op.shared, row + op.anchorRow, column + op.anchorColumn, results[i]);
+	}
+	return results[ops.count() - 1];
+}
+
+Value Formula::operation(const EvalContext& context, const Op& op, int row, int column, const Value* results) const
+{
+	switch (op.code)
+	{
+	case Constant:
+		return op.constant;
+	case Reference:
+		return context.cellValue(row + op.left, column + op.right);
+	case Aggregate:
+		return aggregate(context, op, row, column);
+	case Negate:
+		return negate(results[op.left]);
+	case Match:
+		return match(context, op, row, column, results[op.left]);
+	case Index:
+		return index(context, op, row, column, results[op.left], results[op.right]);
+	case Volatile:
+		return volatileValue(context.volatileState(), op, row, column);
+	default:
+		return arithmetic(op.code, results[op.left], results[op.right]);
+	}
+}
+
+// Evaluates the formula for count cells down a column, starting at row,
+// one operation at a time over blocks of rows held in plain double arrays.
+// The loops carry no branches, so the compiler can vectorize them. A row
+// where an input is not a number or a divisor is zero is evaluated again
+// on its own, which keeps error values exactly as evaluate() gives them.
+void Formula::evaluateRun(const EvalContext& context, int row, int column, int count, Value* results) const
+{
+	if (readsOwnRun(count))
+	{
+		for (int i = 0; i < count; ++i)
+			results[i] = evaluate(context, row + i, column);
+		return;
+	}
+	
+	const int BlockSize = 256;
+	const int root = ops.count() - 1;
+	const VolatileState state = hasVolatiles ? context.volatileState() : VolatileState();
+	QVector<double> slots(ops.count() * BlockSize);
+	bool scalar[BlockSize];
+	
+	for (int start = 0; start < count; start += BlockSize)
+	{
+		const int n = qMin(BlockSize, count - start);
+		memset(scalar, 0, sizeof(scalar));
+		
+		for (int i = 0; i <= root; ++i)
+		{
+			const Op& op = ops[i];
+			double* out = slots.data() + i * BlockSize;
+			const double* a = (operandCount(op.code) >= 1) ? slots.constData() + op.left * BlockSize : 0;
+			const double* b = (operandCount(op.code) == 2) ? slots.constData() + op.right * BlockSize : 0;
+			switch (op.code)
+			{
+			case Constant:
+				for (int k = 0; k < n; ++k)
+					out[k] = op.constant.toNumber();
+				if (!op.constant.isNumber())
+					memset(scalar, 1, sizeof(scalar));
+				break;
+			case Reference:
+				for (int k = 0; k < n; ++k)
+				{
+					Value v = context.cellValue(row + start + k + op.left, column + op.right);
+					out[k] = v.toNumber();
+					scalar[k] |= !v.isNumber();
+				}
+				break;
+			case Aggregate:
+				for (int k = 0; k < n; ++k)
+				{
+					Value v = aggregate(context, op, row + start + k, column);
+					out[k] = v.toNumber();
+					scalar[k] |= !v.isNumber();
+				}
+				break;
+			case Negate:
+				for (int k = 0; k < n; ++k)
+					out[k] = -a[k];
+				break;
+			case Add:
+				for (int k = 0; k < n; ++k)
+					out[k] = a[k] + b[k];
+				break;
+			case Subtract:
+				for (int k = 0; k < n; ++k)
+					out[k] = a[k] - b[k];
+				break;
+			case Multiply:
+				for (int k = 0; k < n; ++k)
+					out[k] = a[k] * b[k];
+				break;
+			case Divide:
+				for (int k = 0; k < n; ++k)
+					out[k] = a[k] / b[k];
+				for (int k = 0; k < n; ++k)
+					scalar[k] |= (b[k] == 0.0);
+				break;
+			case Match:
+				for (int k = 0; k < n; ++k)
+				{
+					Value v = match(context, op, row + start + k, column, a[k]);
+					out[k] = v.toNumber();
+					scalar[k] |= !v.isNumber();
+				}
+				break;
+			case Index:
+				for (int k = 0; k < n; ++k)
+				{
+					Value v = index(context, op, row + start + k, column, a[k], b[k]);
+					out[k] = v.toNumber();
+					scalar[k] |= !v.isNumber();
+				}
+				break;
+			case Volatile:
+				for (int k = 0; k < n; ++k)
+					out[k] = volatileValue(state, op, row + start + k, column).toNumber();
+				break;
+			}
+		}
+		
+		const double* out = slots.constData() + root * BlockSize;
+		for (int k = 0; k < n; ++k)
+			results[start + k] = scalar[k] ? evaluate(context, row + start + k, column) : Value(out[k]);
+	}
+}
+
+// True if a reference lands on another cell of a run of count cells down
+// the column, or on the cell itself; such runs depend on their own order.
+bool Formula::readsOwnRun(int count) const
+{
+	foreach (const Op& op, ops)
+	{
+		if (op.code == Reference && op.right == 0 && qAbs(op.left) < count)
+			return true;
+	}
+	foreach (const Range& r, ranges)
+	{
+		if (r.left <= 0 && r.right >= 0 && r.top < count && r.bottom > -count)
+			return true;
+	}
+	return false;
+}
+
+// The cells and ranges the formula reads when evaluated at (row, column),
+// with x for the column and y for the row.
+QVector<QRect> Formula::precedents(int row, int column) const
+{
+	QVector<QRect> result;
+	foreach (const Op& op, ops)
+	{
+		if (op.code == Reference)
+			result.append(QRect(column + op.right, row + op.left, 1, 1));
+	}
+	foreach (const Range& r, ranges)
+	{
+		result.append(QRect(QPoint(column + r.left, row + r.top),
+			QPoint(column + r.right, row + r.bottom)));
+	}
+	return result;
+}
+
+// The one-column ranges the formula's MATCH and VLOOKUP calls search when
+// evaluated at (row, column), which the sheet keeps lookup tables for.
+QVector<QRect> Formula::lookupRanges(int row, int column) const
+{
+	QVector<QRect> result;
+	foreach (const Op& op, ops)
+	{
+		if (op.code != Match)
+			continue;
+		const Range& r = ranges[op.range];
+		if (r.left == r.right)
+			result.append(QRect(QPoint(column + r.left, row + r.top), QPoint(column + r.right, row + r.bottom)));
+	}
+	return result;
+}
+
+Value Formula::aggregate(const EvalContext& context, const Op& op, int row, int column) const
+{
+	const Range& r = ranges[op.left];
+	RangeTotals totals = context.rangeTotals(row + r.top, column + r.left,
+		row + r.bottom, column + r.right);
+	return totals.result(RangeTotals::Function(op.right));
+}
+
+// A key that is not found, or a range that is neither one column nor one
+// row, gives NotAvailable.
+Value Formula::match(const EvalContext& context, const Op& op, int row, int column, const Value& key) const
+{
+	if (key.isError())
+		return key;
+	const Range& r = ranges[op.range];
+	if (r.top != r.bottom && r.left != r.right)
+		return Value::fromError(Value::NotAvailable);
+	int offset = context.match(key, row + r.top, column + r.left, row + r.bottom, column + r.right, op.right);
+	if (offset < 0)
+		return Value::fromError(Value::NotAvailable);
+	return double(offset + 1);
+}
+
+Value Formula::index(const EvalContext& context, const Op& op, int row, int column,
+	const Value& rowNumber, const Value& columnNumber) const
+{
+	if (rowNumber.isError())
+		return rowNumber;
+	if (columnNumber.isError())
+		return columnNumber;
+	if (!rowNumber.isNumber() || !columnNumber.isNumber())
+		return Value::fromError(Value::TypeMismatch);
+	
+	const Range& r = ranges[op.range];
+	double i = rowNumber.toNumber();
+	double j = columnNumber.toNumber();
+	if (!(i >= 1.0 && i < r.bottom - r.top + 2) || !(j >= 1.0 && j < r.right - r.left + 2))
+		return Value::fromError(Value::InvalidReference);
+	return context.cellValue(row + r.top + int(i) - 1, column + r.left + int(j) - 1);
+}
+
+Value Formula::volatileValue(const VolatileState& state, const Op& op, int row, int column)
+{
+	if (op.right == Now)
+		return state.now;
+	return state.random(row, column, op.left);
+}
+
+// A uniform number in [0, 1) with the 53 bits a double holds.
+double VolatileState::random(int row, int column, int draw) const
+{
+	quint64 stream = mix(seed ^ mix(pass));
+	quint64 x = mix(stream ^ (quint64(column) << 48 | quint64(row) << 24 | quint64(draw)));
+	return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double VolatileState::currentTime()
+{
+	QDateTime time = QDateTime::currentDateTime();
+	return QDate(1899, 12, 30).daysTo(time.date()) + QTime(0, 0).msecsTo(time.time()) / 86400000.0;
+}
+
+RangeTotals::RangeTotals()
+	: sum(0.0), count(0), min(0.0), max(0.0)
+{
+}
+
+void RangeTotals::add(const Value& value)
+{
+	if (value.isNumber())
+	{
+		double d = value.toNumber();
+		min = (count == 0) ? d : qMin(min, d);
+		max = (count == 0) ? d : qMax(max, d);
+		sum += d;
+		++count;
+	}
+	else if (value.isError() && !error.isError())
+		error = value;
+}
+
+void RangeTotals::merge(const RangeTotals& other)
+{
+	if (other.count > 0)
+	{
+		min = (count == 0) ? other.min : qMin(min, other.min);
+		max = (count == 0) ? other.max : qMax(max, other.max);
+		sum += other.sum;
+		count += other.count;
+	}
+	if (other.error.isError() && !error.isError())
+		error = other.error;
+}
+
+Value RangeTotals::result(Function function) const
+{
+	if (error.isError())
+		return error;
+	switch (function)
+	{
+	case Sum:
+		return sum;
+	case Average:
+		if (count == 0)
+			return Value::fromError(Value::DivisionByZero);
+		return sum / count;
+	case Count:
+		return double(count);
+	case Min:
+		return min;
+	default:
+		return max;
+	}
+}
+
+Value Formula::negate(const Value& operand)
+{
+	if (operand.isNumber())
+		return -operand.toNumber();
+	if (operand.isError())
+		return operand;
+	return Value::fromError(Value::TypeMismatch);
+}
+
+// Errors propagate from the left operand first, then the right one; any
+// other operand that is not a number is a type mismatch.
+Value Formula::arithmetic(OpCode code, const Value& left, const Value& right)
+{
+	if (left.isError())
+		return left;
+	if (right.isError())
+		return right;
+	if (!left.isNumber() || !right.isNumber())
+		return Value::fromError(Value::TypeMismatch);
+	
+	double a = left.toNumber();
+	double b = right.toNumber();
+	switch (code)
+	{
+	case Add:
+		return a + b;
+	case Subtract:
+		return a - b;
+	case Multiply:
+		return a * b;
+	default:
+		if (b == 0.0)
+			return Value::fromError(Value::DivisionByZero);
+		return a / b;
+	}
+}
+
+const Formula* FormulaCache::acquire(const QString& expr, int row, int column)
+{
+	QString key = relativeKey(expr, row, column);
+	
+	Cache* c = cache();
+	QMutexLocker locker(&c->mutex);
+	Formula*& formula = c->formulas[key];
+	if (!formula)
+	{
+		formula = Formula::compile(expr, row, column);
+		formula->key = key;
+		for (int i = 0; i < formula->ops.count(); ++i)
+		{
+			if (!formula->sharedKeys[i].isEmpty())
+				formula->ops[i].shared = internExpression(c, formula->sharedKeys[i]);
+		}
+		formula->sharedKeys.clear();
+	}
+	++formula->refCount;
+	return formula;
+}
+
+// Takes one more reference to a formula already acquired, for a holder
+// that keeps it past the cell it came from.
+void FormulaCache::retain(const Formula* formula)
+{
+	if (!formula)
+		return;
+	
+	Cache* c = cache();
+	QMutexLocker locker(&c->mutex);
+	++const_cast<Formula*>(formula)->refCount;
+}
+
+void FormulaCache::release(const Formula* formula)
+{
+	if (!formula)
+		return;
+	
+	Cache* c = cache();
+	QMutexLocker locker(&c->mutex);
+	Formula* f = const_cast<Formula*>(formula);
+	if (--f->refCount == 0)
+	{
+		foreach (const Formula::Op& op, f->ops)
+		{
+			if (op.shared >= 0)
+				releaseExpression(c, op.shared);
+		}
+		c->formulas.remove(f->key);
+		delete f;
+	}
+}
+
+int FormulaCache::count()
+{
+	Cache* c = cache();
+	QMutexLocker locker(&c->mutex);
+	return c->formulas.count();
+}
+
+uint qHash(const SharedResults::Key& key)
+{
+	return ::qHash(quint64(key.expression) << 32 ^ quint64(quint32(key.row)) << 12 ^ quint32(key.column));
+}
+
+bool SharedResults::find(int expression, int row, int column, Value* value) const
+{
+	Key key;
+	key.expression = expression;
+	key.row = row;
+	key.column = column;
+	QHash<Key, Value>::const_iterator i = values.constFind(key);
+	if (i == values.constEnd())
+		return false;
+	*value = i.value();
+	return true;
+}
+
+void SharedResults::insert(int expression, int row, int column, const Value& value)
+{
+	Key key;
+	key.expression = expression;
+	key.row = row;
+	key.column = column;
+	values.insert(key, value);
+}
@@ -0,0 +1,181 @@
+#ifndef FORMULA_H
+#define FORMULA_H
+
+#include <QHash>
+#include <QRect>
+#include <QString>
+#include <QVector>
+#include "value.h"
+
+// What a range function needs to know about the values in a range.
+// Strings and empty cells are skipped; the first error found is kept.
+struct RangeTotals
+{
+	enum Function { Sum, Average, Count, Min, Max };
+	
+	RangeTotals();
+	void add(const Value& value);
+	void merge(const RangeTotals& other);
+	Value result(Function function) const;
+	
+	double sum;
+	int count;
+	double min;
+	double max;
+	Value error;
+};
+
+// What NOW() and RAND() read during one recalculation: the time, in days
+// since 30 December 1899 as other spreadsheets count it, and the pass of
+// the random stream. A RAND() draw is a hash of the seed, the pass, the
+// cell and the call, so the same seed gives the same numbers whatever
+// order or thread the cells are evaluated in.
+struct VolatileState
+{
+	VolatileState() : now(0.0), seed(0), pass(0) {}
+	double random(int row, int column, int draw) const;
+	static double currentTime();
+	
+	double now;
+	quint64 seed;
+	quint64 pass;
+};
+
+// Values of sub-expressions that formulas in different cells share, such
+// as the same SUM over the same range, keyed by the sub-expression's
+// interned key and the first cell it reads. A sheet keeps one for the
+// current generation of its values and clears it whenever a value may
+// change, so each shared sub-expression is evaluated once per
+// recalculation. Not safe to use from several threads at once.
+class SharedResults
+{
+public:
+	bool find(int expression, int row, int column, Value* value) const;
+	void insert(int expression, int row, int column, const Value& value);
+	void clear() { values.clear(); }
+private:
+	struct Key
+	{
+		int expression;
+		int row;
+		int column;
+		
+		bool operator==(const Key& other) const
+		{
+			return expression == other.expression && row == other.row && column == other.column;
+		}
+	};
+	friend uint qHash(const Key& key);
+	
+	QHash<Key, Value> values;
+};
+
+class EvalContext
+{
+public:
+	virtual ~EvalContext() {}
+	virtual Value cellValue(int row, int column) const = 0;
+	virtual RangeTotals rangeTotals(int top, int left, int bottom, int right) const = 0;
+	// The offset of key within a one-column or one-row range, or -1. A
+	// type of 0 asks for an equal value; 1 for the largest value not above
+	// key in ascending data, -1 for the smallest not below it in descending
+	// data.
+	virtual int match(const Value& key, int top, int left, int bottom, int right, int type) const = 0;
+	virtual VolatileState volatileState() const = 0;
+	// Where evaluation may look up and store shared sub-expressions, or 0.
+	virtual SharedResults* sharedResults() const { return 0; }
+};
+
+// Where RangeIndex and LookupIndex read the cells they index. An empty
+// cell has no value.
+class ValueSource
+{
+public:
+	virtual ~ValueSource() {}
+	virtual bool storedValue(int row, int column, Value* value) const = 0;
+};
+
+// A formula compiled to a flat list of operations. References are stored
+// as offsets from the cell that owns the formula, so a formula copied down
+// a column compiles to the same operations in every row. Operands precede
+// the operations that use them and every distinct sub-expression appears
+// once, so evaluation is a single forward pass that computes each shared
+// sub-expression once. Constant sub-expressions are folded away.
+// Sub-expressions that read a range are also interned across formulas by
+// FormulaCache, so that other cells reading the same cells can reuse their
+// value through the context's SharedResults.
+class Formula
+{
+public:
+	enum OpCode { Constant, Reference, Aggregate, Negate, Add, Subtract, Multiply, Divide, Match, Index, Volatile };
+	enum VolatileFunction { Now, Rand };
+	
+	struct Op
+	{
+		OpCode code;
+		int left;     // operand, row offset of a Reference, range of an Aggregate, or RAND() draw
+		int right;    // operand, column offset of a Reference, RangeTotals::Function, match type,
+		              // or VolatileFunction
+		int range;    // range of a Match or an Index
+		int shared;   // interned key of a sub-expression other formulas may share, or -1
+		int anchorRow;     // first cell a shared sub-expression reads,
+		int anchorColumn;  // as an offset from the formula's cell
+		Value constant;
+	};
+	
+	struct Range
+	{
+		int top;
+		int left;
+		int bottom;
+		int right;
+	};
+	
+	static Formula* compile(const QString& expr, int row, int column);
+	static QString errorLiteral(Value::ErrorCode code);
+	
+	Value evaluate(const EvalContext& context, int row, int column) const;
+	void evaluateRun(const EvalContext& context, int row, int column, int count, Value* results) const;
+	const QVector<Op>& operations() const { return ops; }
+	QVector<QRect> precedents(int row, int column) const;
+	QVector<QRect> lookupRanges(int row, int column) const;
+	bool isVolatile() const { return hasVolatiles; }
+	
+	static Value negate(const Value& operand);
+	static Value arithmetic(OpCode code, const Value& left, const Value& right);
+private:
+	friend class FormulaCache;
+	
+	Formula() : hasVolatiles(false), hasShared(false), refCount(0) {}
+	Value operation(const EvalContext& context, const Op& op, int row, int column, const Value* results) const;
+	void findSharedOps();
+	bool readsOwnRun(int count) const;
+	Value aggregate(const EvalContext& context, const Op& op, int row, int column) const;
+	Value match(const EvalContext& context, const Op& op, int row, int column, const Value& key) const;
+	Value index(const EvalContext& context, const Op& op, int row, int column,
+		const Value& rowNumber, const Value& columnNumber) const;
+	static Value volatileValue(const VolatileState& state, const Op& op, int row, int column);
+	
+	QVector<Op> ops;
+	QVector<Range> ranges;
+	bool hasVolatiles;
+	bool hasShared;
+	QVector<QString> sharedKeys;
+	QString key;
+	int refCount;
+};
+
+// Interns compiled formulas by their relative form, so that every cell
+// whose formula reads the same relative to its own position shares one
+// Formula, and the keys of their shared sub-expressions, which live as
+// long as some formula uses them. Safe to use from any thread.
+class FormulaCache
+{
+public:
+	static const Formula* acquire(const QString& expr, int row, int column);
+	static void retain(const Formula* formula);
+	static void release(const Formula* formula);
+	static int count();
+};
+
+#endif
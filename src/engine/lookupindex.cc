@@ -0,0 +1,223 @@
+#include <QtCore>
+#include "lookupindex.h"
+
+namespace
+{
+	// An empty cell never equals a key and sorts after every value.
+	Value cellValue(const ValueSource* source, int row, int column)
+	{
+		Value value;
+		return source->storedValue(row, column, &value) ? value : Value::fromError(Value::NotAvailable);
+	}
+	
+	// Equal keys for values Value::compare() finds equal; none for errors.
+	QString keyText(const Value& value)
+	{
+		if (value.isNumber())
+		{
+			double d = value.toNumber();
+			return '#' + QString::number(d == 0.0 ? 0.0 : d, 'g', 17);
+		}
+		if (value.isString())
+			return '$' + value.toString().toLower();
+		return QString();
+	}
+}
+
+LookupIndex::LookupIndex(const ValueSource* source, int rowCount, int columnCount)
+{
+	this->source = source;
+	this->rowCount = rowCount;
+	this->columnCount = columnCount;
+}
+
+LookupIndex::~LookupIndex()
+{
+	clear();
+}
+
+// Counts the formula at (row, column) as a user of every range it
+// searches.
+void LookupIndex::retain(const Formula* formula, int row, int column)
+{
+	if (!formula)
+		return;
+	foreach (const QRect& r, formula->lookupRanges(row, column))
+	{
+		quint64 name;
+		if (tableName(r.top(), r.left(), r.bottom(), &name))
+			++users[name];
+	}
+}
+
+// Drops the table of each range the formula searches once no other
+// formula searches it.
+void LookupIndex::release(const Formula* formula, int row, int column)
+{
+	if (!formula)
+		return;
+	foreach (const QRect& r, formula->lookupRanges(row, column))
+	{
+		quint64 name;
+		if (!tableName(r.top(), r.left(), r.bottom(), &name))
+			continue;
+		QHash<quint64, int>::iterator i = users.find(name);
+		if (i == users.end() || --i.value() > 0)
+			continue;
+		users.erase(i);
+		Table* t = tables.take(name);
+		if (t)
+		{
+			tablesByColumn.remove(t->column, t);
+			delete t;
+		}
+	}
+}
+
+void LookupIndex::invalidate(int row, int column)
+{
+	QMultiHash<int, Table*>::const_iterator i = tablesByColumn.constFind(column);
+	for (; i != tablesByColumn.constEnd() && i.key() == column; ++i)
+	{
+		Table* t = i.value();
+		if (row >= t->top && row < t->top + t->values.count())
+			t->stale.insert(row - t->top, 0);
+	}
+}
+
+// Forgets every table but keeps their users; the next lookup of a range
+// builds its table again.
+void LookupIndex::invalidateAll()
+{
+	qDeleteAll(tables);
+	tables.clear();
+	tablesByColumn.clear();
+}
+
+void LookupIndex::clear()
+{
+	invalidateAll();
+	users.clear();
+}
+
+// A new table starts with every row stale, so it is filled by the same
+// refresh that later folds in edits. A range no formula retained gets no
+// table and is searched where it lies.
+int LookupIndex::match(const Value& key, int top, int column, int bottom, int type) const
+{
+	quint64 name;
+	if (!tableName(top, column, bottom, &name))
+		return -1;
+	top = qMax(top, 0);
+	bottom = qMin(bottom, rowCount - 1);
+	
+	Table* t = tables.value(name);
+	if (!t && !users.contains(name))
+		return scan(source, rowCount, columnCount, key, top, column, bottom, column, type);
+	if (!t)
+	{
+		t = new Table;
+		t->column = column;
+		t->top = top;
+		t->values.fill(Value::fromError(Value::NotAvailable), bottom - top + 1);
+		for (int i = 0; i < t->values.count(); ++i)
+			t->stale.insert(i, 0);
+		tables.insert(name, t);
+		tablesByColumn.insert(column, t);
+	}
+	refresh(t);
+	
+	if (type != 0)
+		return search(t->values, key, type);
+	QHash<QString, QVector<int> >::const_iterator i = t->rows.constFind(keyText(key));
+	if (i == t->rows.constEnd() || i.value().isEmpty())
+		return -1;
+	return i.value().first();
+}
+
+// Ranges are clamped to the sheet before they are named, so a formula
+// and the lookups it makes agree on the table.
+bool LookupIndex::tableName(int top, int column, int bottom, quint64* name) const
+{
+	top = qMax(top, 0);
+	bottom = qMin(bottom, rowCount - 1);
+	if (column < 0 || column >= columnCount || top > bottom)
+		return false;
+	*name = quint64(column) << 40 | quint64(top) << 20 | quint64(bottom);
+	return true;
+}
+
+// Rows are taken off the stale list before the cell is read: evaluating it
+// may look up this same range, and that lookup must not fold the row in
+// a second time.
+void LookupIndex::refresh(Table* t) const
+{
+	while (!t->stale.isEmpty())
+	{
+		int i = t->stale.begin().key();
+		t->stale.erase(t->stale.begin());
+		
+		QString oldKey = keyText(t->values[i]);
+		if (!oldKey.isNull())
+		{
+			QVector<int>& rows = t->rows[oldKey];
+			QVector<int>::iterator j = qBinaryFind(rows.begin(), rows.end(), i);
+			if (j != rows.end())
+				rows.erase(j);
+			if (rows.isEmpty())
+				t->rows.remove(oldKey);
+		}
+		
+		Value value = cellValue(source, t->top + i, t->column);
+		t->values[i] = value;
+		QString newKey = keyText(t->values[i]);
+		if (!newKey.isNull())
+		{
+			QVector<int>& rows = t->rows[newKey];
+			rows.insert(qLowerBound(rows.begin(), rows.end(), i), i);
+		}
+	}
+}
+
+// Searches a range where it lies, for a range no table is kept for or an
+// evaluation context that keeps no tables of its own.
+int LookupIndex::scan(const ValueSource* source, int rowCount, int columnCount,
+	const Value& key, int top, int left, int bottom, int right, int type)
+{
+	QVector<Value> values;
+	for (int row = qMax(top, 0); row <= qMin(bottom, rowCount - 1); ++row)
+	{
+		for (int column = qMax(left, 0); column <= qMin(right, columnCount - 1); ++column)
+			values.append(cellValue(source, row, column));
+	}
+	return search(values, key, type);
+}
+
+// Exact matches scan; the others binary-search data assumed to be sorted,
+// ascending for type 1 and descending for type -1, for the last value on
+// the near side of key. Errors and empty cells are never on the near side.
+int LookupIndex::search(const QVector<Value>& values, const Value& key, int type)
+{
+	if (type == 0)
+	{
+		for (int i = 0; i < values.count(); ++i)
+		{
+			if (values[i].compare(key) == 0)
+				return i;
+		}
+		return -1;
+	}
+	
+	int low = 0;
+	int high = values.count();
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		int order = values[middle].compare(key);
+		if (!values[middle].isError() && ((type > 0) ? order <= 0 : order >= 0))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low - 1;
+}
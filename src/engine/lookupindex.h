@@ -0,0 +1,55 @@
+#ifndef LOOKUPINDEX_H
+#define LOOKUPINDEX_H
+
+#include <QHash>
+#include <QMap>
+#include <QVector>
+#include "formula.h"
+
+// Lookup tables over one-column ranges, shared by every MATCH and VLOOKUP
+// that searches the same range. A table keeps the values of its range for
+// binary search and a hash from each value to the rows holding it for
+// exact matches. invalidate() marks a row stale and the next lookup folds
+// it in, so an edit costs one update rather than a rebuild. Tables are only
+// kept for ranges that a formula retained, and are dropped when the last
+// of those formulas is released.
+class LookupIndex
+{
+public:
+	LookupIndex(const ValueSource* source, int rowCount, int columnCount);
+	~LookupIndex();
+	void retain(const Formula* formula, int row, int column);
+	void release(const Formula* formula, int row, int column);
+	void invalidate(int row, int column);
+	void invalidateAll();
+	void clear();
+	int match(const Value& key, int top, int column, int bottom, int type) const;
+	
+	static int search(const QVector<Value>& values, const Value& key, int type);
+	static int scan(const ValueSource* source, int rowCount, int columnCount,
+		const Value& key, int top, int left, int bottom, int right, int type);
+private:
+	LookupIndex(const LookupIndex&);
+	LookupIndex& operator=(const LookupIndex&);
+	
+	struct Table
+	{
+		int column;
+		int top;
+		QVector<Value> values;
+		QHash<QString, QVector<int> > rows;
+		QMap<int, char> stale;
+	};
+	
+	bool tableName(int top, int column, int bottom, quint64* name) const;
+	void refresh(Table* t) const;
+	
+	const ValueSource* source;
+	int rowCount;
+	int columnCount;
+	mutable QHash<quint64, Table*> tables;
+	mutable QMultiHash<int, Table*> tablesByColumn;
+	QHash<quint64, int> users;
+};
+
+#endif
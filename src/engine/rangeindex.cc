@@ -0,0 +1,185 @@
+#include <QtCore>
+#include <limits>
+#include "rangeindex.h"
+
+class RangeIndex::Column
+{
+public:
+	Column(int rowCount);
+	void invalidate(int row);
+	RangeTotals totals(const ValueSource* source, int column, int top, int bottom);
+private:
+	void set(int row, const Value& value);
+	
+	int rowCount;
+	QVector<Value> values;
+	QVector<double> sums;
+	QVector<int> counts;
+	QVector<int> errors;
+	QVector<double> mins;
+	QVector<double> maxs;
+	QMap<int, char> stale;
+};
+
+RangeIndex::Column::Column(int rowCount)
+	: values(rowCount, Value::fromString(QString())),
+	  sums(2 * rowCount, 0.0), counts(2 * rowCount, 0), errors(2 * rowCount, 0),
+	  mins(2 * rowCount, std::numeric_limits<double>::infinity()),
+	  maxs(2 * rowCount, -std::numeric_limits<double>::infinity())
+{
+	this->rowCount = rowCount;
+	for (int row = 0; row < rowCount; ++row)
+		stale.insert(row, 0);
+}
+
+void RangeIndex::Column::invalidate(int row)
+{
+	stale.insert(row, 0);
+}
+
+// Stale rows are refreshed one at a time and taken off the list first: a
+// cell read here may itself evaluate a range over this column, and that
+// query must neither see a row half-refreshed nor refresh it again. Only
+// rows inside the range are read, as a cell outside it may depend on the
+// cell being evaluated.
+RangeTotals RangeIndex::Column::totals(const ValueSource* source, int column, int top, int bottom)
+{
+	for (;;)
+	{
+		QMap<int, char>::iterator i = stale.lowerBound(top);
+		if (i == stale.end() || i.key() > bottom)
+			break;
+		int row = i.key();
+		stale.erase(i);
+		Value value;
+		set(row, source->storedValue(row, column, &value) ? value : Value::fromString(QString()));
+	}
+	
+	RangeTotals result;
+	int errorCount = 0;
+	result.sum = 0.0;
+	result.count = 0;
+	result.min = std::numeric_limits<double>::infinity();
+	result.max = -std::numeric_limits<double>::infinity();
+	for (int l = top + rowCount, r = bottom + rowCount + 1; l < r; l /= 2, r /= 2)
+	{
+		if (l & 1)
+		{
+			result.sum += sums[l];
+			result.count += counts[l];
+			errorCount += errors[l];
+			result.min = qMin(result.min, mins[l]);
+			result.max = qMax(result.max, maxs[l]);
+			++l;
+		}
+		if (r & 1)
+		{
+			--r;
+			result.sum += sums[r];
+			result.count += counts[r];
+			errorCount += errors[r];
+			result.min = qMin(result.min, mins[r]);
+			result.max = qMax(result.max, maxs[r]);
+		}
+	}
+	if (result.count == 0)
+		result.min = result.max = 0.0;
+	
+	if (errorCount > 0)
+	{
+		for (int row = top; row <= bottom && !result.error.isError(); ++row)
+		{
+			if (values[row].isError())
+				result.error = values[row];
+		}
+	}
+	return result;
+}
+
+// Every node on the way up is recomputed from its two children rather
+// than adjusted by the change, so a value that is overwritten leaves no
+// trace in the sums: not the rounding of a huge number, nor an infinity.
+void RangeIndex::Column::set(int row, const Value& value)
+{
+	if (values[row] == value)
+		return;
+	values[row] = value;
+	
+	int i = row + rowCount;
+	sums[i] = value.toNumber();
+	counts[i] = value.isNumber();
+	errors[i] = value.isError();
+	mins[i] = value.isNumber() ? value.toNumber() : std::numeric_limits<double>::infinity();
+	maxs[i] = value.isNumber() ? value.toNumber() : -std::numeric_limits<double>::infinity();
+	for (i /= 2; i >= 1; i /= 2)
+	{
+		sums[i] = sums[2 * i] + sums[2 * i + 1];
+		counts[i] = counts[2 * i] + counts[2 * i + 1];
+		errors[i] = errors[2 * i] + errors[2 * i + 1];
+		mins[i] = qMin(mins[2 * i], mins[2 * i + 1]);
+		maxs[i] = qMax(maxs[2 * i], maxs[2 * i + 1]);
+	}
+}
+
+RangeIndex::RangeIndex(const ValueSource* source, int rowCount, int columnCount)
+	: columns(columnCount, 0)
+{
+	this->source = source;
+	this->rowCount = rowCount;
+}
+
+RangeIndex::~RangeIndex()
+{
+	clear();
+}
+
+void RangeIndex::invalidate(int row, int column)
+{
+	if (column >= 0 && column < columns.count() && columns[column])
+		columns[column]->invalidate(row);
+}
+
+// Drops every column; each is rebuilt from the cells when next queried.
+void RangeIndex::clear()
+{
+	for (int i = 0; i < columns.count(); ++i)
+	{
+		delete columns[i];
+		columns[i] = 0;
+	}
+}
+
+RangeTotals RangeIndex::totals(int top, int left, int bottom, int right) const
+{
+	top = qMax(top, 0);
+	left = qMax(left, 0);
+	bottom = qMin(bottom, rowCount - 1);
+	right = qMin(right, columns.count() - 1);
+	
+	RangeTotals result;
+	for (int column = left; column <= right && top <= bottom; ++column)
+	{
+		if (!columns[column])
+			columns[column] = new Column(rowCount);
+		result.merge(columns[column]->totals(source, column, top, bottom));
+	}
+	return result;
+}
+
+// Adds up a range cell by cell, for evaluation contexts that keep no index
+// of their own. Cells without a value are left out.
+RangeTotals RangeIndex::scan(const ValueSource* source, int rowCount, int columnCount,
+	int top, int left, int bottom, int right)
+{
+	RangeTotals result;
+	for (int column = qMax(left, 0); column <= qMin(right, columnCount - 1); ++column)
+	{
+		for (int row = qMax(top, 0); row <= qMin(bottom, rowCount - 1); ++row)
+		{
+			Value value;
+			if (source->storedValue(row, column, &value))
+				result.add(value);
+		}
+	}
+	return result;
+}
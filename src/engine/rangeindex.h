@@ -0,0 +1,36 @@
+#ifndef RANGEINDEX_H
+#define RANGEINDEX_H
+
+#include <QVector>
+#include "formula.h"
+
+// Indexes the values of a sheet column by column for range functions: a
+// segment tree of sums, counts, minima and maxima, so a range costs
+// O(log n) per column instead of a scan. A range is added up from the
+// nodes that cover it, never as the difference of two prefixes, so values
+// outside it cannot cancel out its digits. Columns are
+// built on first use. invalidate() only marks a row stale; the next query
+// that covers the row reads the cell again and updates the trees.
+class RangeIndex
+{
+public:
+	RangeIndex(const ValueSource* source, int rowCount, int columnCount);
+	~RangeIndex();
+	void invalidate(int row, int column);
+	void clear();
+	RangeTotals totals(int top, int left, int bottom, int right) const;
+	
+	static RangeTotals scan(const ValueSource* source, int rowCount, int columnCount,
+		int top, int left, int bottom, int right);
+private:
+	RangeIndex(const RangeIndex&);
+	RangeIndex& operator=(const RangeIndex&);
+	
+	class Column;
+	
+	const ValueSource* source;
+	int rowCount;
+	mutable QVector<Column*> columns;
+};
+
+#endif
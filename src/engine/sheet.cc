@@ -0,0 +1,884 @@
+#include <QtCore>
+#include <new>
+#include "cyclesolver.h"
+#include "sheet.h"
+
+namespace
+{
+	// One row of a data table: the output cell and the inputs for each
+	// column, and the results once evaluated.
+	struct DataTableRow
+	{
+		const SheetSnapshot* snapshot;
+		QPoint rowInput;
+		QPoint columnInput;
+		Value columnValue;
+		QVector<Value> rowValues;
+		QVector<QPoint> outputs;
+		QVector<Value> results;
+	};
+	
+	void evaluateDataTableRow(DataTableRow& row)
+	{
+		Scenario scenario(row.snapshot);
+		row.results.resize(row.outputs.count());
+		for (int j = 0; j < row.outputs.count(); ++j)
+		{
+			scenario.clearInputs();
+			if (row.columnInput.x() >= 0)
+				scenario.setInput(row.columnInput, row.columnValue);
+			if (row.rowInput.x() >= 0)
+				scenario.setInput(row.rowInput, row.rowValues[j]);
+			row.results[j] = scenario.cellValue(row.outputs[j].y(), row.outputs[j].x());
+		}
+	}
+	
+	// Ties the values stored in a file to the formulas they were computed
+	// from and to the engine and settings that computed them.
+	uint formulaStamp(uint stamp, int row, int column, const QString& formula)
+	{
+		return (stamp * 31 + (row << 8 | column)) ^ qHash(formula);
+	}
+	
+	void solveCycle(CycleSolver& solver)
+	{
+		solver.solve();
+	}
+}
+
+Sheet::Sheet(int rowCount, int columnCount)
+	: entries(rowCount * columnCount), dependencies(rowCount, columnCount),
+	  rangeIndex(this, rowCount, columnCount), lookupIndex(this, rowCount, columnCount)
+{
+	rows = rowCount;
+	columns = columnCount;
+	autoRecalc = true;
+	iterativeCalc = false;
+	storeValues = true;
+	maxIterations = 100;
+	maxChange = 0.001;
+	cyclesPending = false;
+	volatiles.now = VolatileState::currentTime();
+	volatiles.seed = QDateTime::currentMSecsSinceEpoch();
+}
+
+Sheet::~Sheet()
+{
+	reset();
+}
+
+void Sheet::clear()
+{
+	QMutexLocker locker(&mutex);
+	reset();
+}
+
+// The text is what a user would type into the cell: a number, a string, a
+// string quoted with ' or a formula starting with =. An empty text empties
+// the cell. Cells outside the sheet are ignored.
+void Sheet::setFormula(int row, int column, const QString& formula)
+{
+	QMutexLocker locker(&mutex);
+	if (contains(row, column))
+		assign(row, column, formula);
+}
+
+QString Sheet::formula(int row, int column) const
+{
+	QMutexLocker locker(&mutex);
+	if (!contains(row, column))
+		return QString();
+	Entry* e = entry(row, column);
+	return e ? e->formula() : QString();
+}
+
+// An empty cell, or one outside the sheet, reads as 0.
+Value Sheet::value(int row, int column) const
+{
+	QMutexLocker locker(&mutex);
+	settle();
+	return cellValue(row, column);
+}
+
+RangeTotals Sheet::totals(int top, int left, int bottom, int right) const
+{
+	QMutexLocker locker(&mutex);
+	settle();
+	return rangeIndex.totals(top, left, bottom, right);
+}
+
+// The cells that hold something, row by row.
+QList<QPoint> Sheet::cells() const
+{
+	QMutexLocker locker(&mutex);
+	QList<QPoint> result;
+	for (int row = 0; row < rows; ++row)
+	{
+		for (int column = 0; column < columns; ++column)
+		{
+			if (entry(row, column))
+				result.append(QPoint(column, row));
+		}
+	}
+	return result;
+}
+
+bool Sheet::autoRecalculate() const
+{
+	QMutexLocker locker(&mutex);
+	return autoRecalc;
+}
+
+void Sheet::setAutoRecalculate(bool recalc)
+{
+	QMutexLocker locker(&mutex);
+	autoRecalc = recalc;
+	if (autoRecalc)
+		invalidateAll();
+}
+
+bool Sheet::iterativeCalculation() const
+{
+	QMutexLocker locker(&mutex);
+	return iterativeCalc;
+}
+
+// Without iterative calculation every cell on a circular chain of
+// references reads as a circular reference error.
+void Sheet::setIterativeCalculation(bool iterative)
+{
+	QMutexLocker locker(&mutex);
+	iterativeCalc = iterative;
+	invalidateAll();
+}
+
+int Sheet::iterationLimit() const
+{
+	QMutexLocker locker(&mutex);
+	return maxIterations;
+}
+
+double Sheet::iterationTolerance() const
+{
+	QMutexLocker locker(&mutex);
+	return maxChange;
+}
+
+void Sheet::setIterationLimits(int maxIterations, double maxChange)
+{
+	QMutexLocker locker(&mutex);
+	this->maxIterations = maxIterations;
+	this->maxChange = maxChange;
+	if (iterativeCalc)
+		invalidateAll();
+}
+
+bool Sheet::storesValues() const
+{
+	QMutexLocker locker(&mutex);
+	return storeValues;
+}
+
+// Without stored values a file opens with every formula still to be
+// evaluated.
+void Sheet::setStoreValues(bool store)
+{
+	QMutexLocker locker(&mutex);
+	storeValues = store;
+}
+
+quint64 Sheet::randomSeed() const
+{
+	QMutexLocker locker(&mutex);
+	return volatiles.seed;
+}
+
+// Restarts the random stream, so that the passes that follow draw the same
+// numbers as the last time the seed was set.
+void Sheet::setRandomSeed(quint64 seed)
+{
+	QMutexLocker locker(&mutex);
+	volatiles.seed = seed;
+	volatiles.pass = 0;
+	if (autoRecalc)
+		invalidateAll();
+}
+
+// Evaluates every cell again, whether or not automatic recalculation is on.
+void Sheet::recalculate()
+{
+	QMutexLocker locker(&mutex);
+	invalidateAll();
+	if (iterativeCalc)
+		solveCycles();
+	evaluateRuns();
+}
+
+// Brings the dirty cells up to date ahead of being read: the circular
+// groups first, then the runs of a shared formula down a column. Other
+// dirty cells are left to be evaluated when they are read.
+void Sheet::calculate()
+{
+	QMutexLocker locker(&mutex);
+	settle();
+	evaluateRuns();
+}
+
+// Cells that call NOW() or RAND() are kept in a set of their own. A
+// volatile pass moves the clock and the random stream on and dirties only
+// those cells and the cells that read them.
+void Sheet::recalculateVolatiles()
+{
+	QMutexLocker locker(&mutex);
+	volatiles.now = VolatileState::currentTime();
+	++volatiles.pass;
+	
+	QVector<int> cells;
+	foreach (int id, volatileCells)
+		cells.append(id);
+	cells += dependencies.cone(cells);
+	foreach (int id, cells)
+		markDirty(id);
+}
+
+bool Sheet::hasVolatiles() const
+{
+	QMutexLocker locker(&mutex);
+	return !volatileCells.isEmpty();
+}
+
+// The cells dirtied by edits since the last call, each with the value it
+// had before, so that a view can tell which of them show anything new.
+// Recalculating everything is not recorded here.
+QList<QPair<QPoint, Value> > Sheet::takeDamage()
+{
+	QMutexLocker locker(&mutex);
+	QList<QPair<QPoint, Value> > result;
+	QHash<int, Value>::const_iterator i;
+	for (i = damaged.constBegin(); i != damaged.constEnd(); ++i)
+	{
+		QPoint pos(dependencies.column(i.key()), dependencies.row(i.key()));
+		result.append(qMakePair(pos, i.value()));
+	}
+	damaged.clear();
+	return result;
+}
+
+// Reads what write() wrote in place of the sheet's cells; the settings are
+// kept. Returns false, leaving the sheet as it was, if the stream does not
+// start with a spreadsheet file's magic number.
+bool Sheet::read(QDataStream& in)
+{
+	QMutexLocker locker(&mutex);
+	quint32 magic;
+	in >> magic;
+	if (magic != MagicNumber && magic != ValuesMagicNumber)
+		return false;
+	quint32 stamp = 0;
+	if (magic == ValuesMagicNumber)
+		in >> stamp;
+	
+	reset();
+	
+	quint16 row, column;
+	QString str;
+	quint8 hasValue;
+	Value value;
+	QList<QPoint> cells;
+	QList<QPoint> cachedCells;
+	QList<Value> cachedValues;
+	uint computed = calculationStamp();
+	
+	while (!in.atEnd())
+	{
+		in >> row >> column >> str;
+		if (contains(row, column))
+		{
+			setEntry(row, column, str);
+			cells.append(QPoint(column, row));
+		}
+		computed = formulaStamp(computed, row, column, str);
+		if (magic == ValuesMagicNumber)
+		{
+			in >> hasValue;
+			if (hasValue)
+			{
+				in >> value;
+				cachedCells.append(QPoint(column, row));
+				cachedValues.append(value);
+			}
+		}
+	}
+	
+	// Stored values are only trusted if they were computed from exactly
+	// these formulas; otherwise every formula is evaluated as before.
+	// Values that hang on NOW() or RAND() are evaluated again even then.
+	foreach (const QPoint& pos, cells)
+		updatePrecedents(pos.y(), pos.x());
+	if (computed == stamp && in.status() == QDataStream::Ok)
+	{
+		QSet<int> unstable = volatileCone();
+		for (int i = 0; i < cachedCells.count(); ++i)
+		{
+			int row = cachedCells[i].y();
+			int column = cachedCells[i].x();
+			if (!contains(row, column) || unstable.contains(dependencies.id(row, column)))
+				continue;
+			Entry* e = entry(row, column);
+			if (e)
+			{
+				e->value = cachedValues[i];
+				e->dirty = false;
+			}
+		}
+		sharedValues.clear();
+	}
+	cyclesPending = true;
+	return true;
+}
+
+// Writes every cell that holds something, row by row. Values are only
+// stored when they are known to be current, and not for cells that call
+// NOW() or RAND() or read such a cell, directly or not, which are
+// evaluated on reading.
+void Sheet::write(QDataStream& out) const
+{
+	QMutexLocker locker(&mutex);
+	settle();
+	
+	QList<QPoint> cells;
+	uint stamp = calculationStamp();
+	for (int row = 0; row < rows; ++row)
+	{
+		for (int column = 0; column < columns; ++column)
+		{
+			Entry* e = entry(row, column);
+			if (e)
+			{
+				cells.append(QPoint(column, row));
+				stamp = formulaStamp(stamp, row, column, e->formula());
+			}
+		}
+	}
+	
+	bool withValues = storeValues && autoRecalc;
+	if (withValues)
+		out << quint32(ValuesMagicNumber) << quint32(stamp);
+	else
+		out << quint32(MagicNumber);
+	
+	QSet<int> unstable;
+	if (withValues)
+		unstable = volatileCone();
+	foreach (const QPoint& pos, cells)
+	{
+		Entry* e = entry(pos.y(), pos.x());
+		out << quint16(pos.y()) << quint16(pos.x()) << e->formula();
+		if (withValues)
+		{
+			bool keep = e->compiled && !unstable.contains(dependencies.id(pos.y(), pos.x()));
+			out << quint8(keep);
+			if (keep)
+				out << evaluate(e, pos.y(), pos.x());
+		}
+	}
+}
+
+// Copies every cell's current value and compiled formula, and marks the
+// cells that depend on any of inputs as the cone. The snapshot keeps its
+// own references to the formulas, so it outlives later edits, from this
+// thread or another.
+SheetSnapshot Sheet::snapshot(const QList<QPoint>& inputs) const
+{
+	QMutexLocker locker(&mutex);
+	settle();
+	return takeSnapshot(inputs);
+}
+
+// Finds a value for input that makes target equal goal and puts it in the
+// input cell. The search runs on a snapshot in which only the cells
+// between input and target are evaluated again at each step.
+SolverResult Sheet::goalSeek(const QPoint& target, double goal, const QPoint& input)
+{
+	QMutexLocker locker(&mutex);
+	settle();
+	SheetSnapshot base = takeSnapshot(QList<QPoint>() << input);
+	Scenario scenario(&base);
+	SolverResult result = Solver::goalSeek(&scenario, input, cellValue(input.y(), input.x()).toNumber(),
+		target, goal);
+	if (result.converged && contains(input.y(), input.x()))
+		assign(input.y(), input.x(), QString::number(result.inputs.first(), 'g', 17));
+	return result;
+}
+
+// Minimizes or maximizes target over inputs with a derivative-free search
+// and puts the best values found in the input cells.
+SolverResult Sheet::optimize(const QPoint& target, Solver::Objective objective, const QVector<QPoint>& inputs)
+{
+	QMutexLocker locker(&mutex);
+	settle();
+	SheetSnapshot base = takeSnapshot(inputs.toList());
+	Scenario scenario(&base);
+	QVector<double> start;
+	foreach (const QPoint& input, inputs)
+		start.append(cellValue(input.y(), input.x()).toNumber());
+	SolverResult result = Solver::optimize(&scenario, inputs, start, target, objective);
+	
+	if (!result.inputs.isEmpty() && qIsFinite(result.value))
+	{
+		for (int i = 0; i < inputs.count(); ++i)
+		{
+			if (contains(inputs[i].y(), inputs[i].x()))
+				assign(inputs[i].y(), inputs[i].x(), QString::number(result.inputs[i], 'g', 17));
+		}
+	}
+	return result;
+}
+
+// Fills table as a what-if table. With both inputs, the top left cell is
+// the output; the top row holds the values for rowInput and the left
+// column those for columnInput. With only columnInput, each cell of the
+// top row is an output; with only rowInput, each cell of the left column
+// is. An input of (-1, -1) is not used. Every combination is evaluated on
+// a worker thread against a snapshot of the sheet, and only the cells
+// that depend on the inputs are evaluated again. Returns false, changing
+// nothing, if the table has no cells to fill or no input is given.
+bool Sheet::fillDataTable(const QRect& table, const QPoint& rowInput, const QPoint& columnInput)
+{
+	QMutexLocker locker(&mutex);
+	QRect range = table & QRect(0, 0, columns, rows);
+	if (range.height() < 2 || range.width() < 2
+		|| (rowInput.x() < 0 && columnInput.x() < 0))
+		return false;
+	
+	settle();
+	QList<QPoint> inputs;
+	if (rowInput.x() >= 0)
+		inputs.append(rowInput);
+	if (columnInput.x() >= 0)
+		inputs.append(columnInput);
+	SheetSnapshot base = takeSnapshot(inputs);
+	
+	const int top = range.top();
+	const int left = range.left();
+	QVector<Value> rowValues;
+	for (int column = left + 1; column <= range.right(); ++column)
+		rowValues.append(cellValue(top, column));
+	
+	QVector<DataTableRow> tableRows(range.height() - 1);
+	for (int i = 0; i < tableRows.count(); ++i)
+	{
+		DataTableRow& row = tableRows[i];
+		row.snapshot = &base;
+		row.rowInput = rowInput;
+		row.columnInput = columnInput;
+		row.columnValue = cellValue(top + 1 + i, left);
+		row.rowValues = rowValues;
+		for (int j = 0; j < rowValues.count(); ++j)
+		{
+			if (rowInput.x() >= 0 && columnInput.x() >= 0)
+				row.outputs.append(QPoint(left, top));
+			else if (columnInput.x() >= 0)
+				row.outputs.append(QPoint(left + 1 + j, top));
+			else
+				row.outputs.append(QPoint(left, top + 1 + i));
+		}
+	}
+	QtConcurrent::blockingMap(tableRows, evaluateDataTableRow);
+	
+	// The results go in as constants, errors as error literals so that the
+	// cells hold the error itself.
+	for (int i = 0; i < tableRows.count(); ++i)
+	{
+		for (int j = 0; j < tableRows[i].results.count(); ++j)
+		{
+			const Value& value = tableRows[i].results[j];
+			if (value.isNumber())
+				assign(top + 1 + i, left + 1 + j, QString::number(value.toNumber(), 'g', 17));
+			else if (value.isError())
+				assign(top + 1 + i, left + 1 + j, '=' + Formula::errorLiteral(value.errorCode()));
+			else
+				assign(top + 1 + i, left + 1 + j, "'" + value.toString());
+		}
+	}
+	return true;
+}
+
+bool Sheet::contains(int row, int column) const
+{
+	return row >= 0 && row < rows && column >= 0 && column < columns;
+}
+
+// Sets the text of a cell and records what it now reads. With automatic
+// recalculation the cells that depend on it, directly or not, are marked
+// dirty too; nothing else is touched.
+void Sheet::assign(int row, int column, const QString& formula)
+{
+	int id = dependencies.id(row, column);
+	markDirty(id);
+	setEntry(row, column, formula);
+	updatePrecedents(row, column);
+	if (autoRecalc)
+	{
+		foreach (int dependent, dependencies.cone(id))
+			markDirty(dependent);
+	}
+}
+
+// The entry and its text live in the arena; formulas are compiled when the
+// text is set, and shared between cells that read the same relative to
+// their own position.
+void Sheet::setEntry(int row, int column, const QString& formula)
+{
+	Entry*& e = entries[column * rows + row];
+	if (e)
+	{
+		lookupIndex.release(e->compiled, row, column);
+		FormulaCache::release(e->compiled);
+		arena.releaseText(e->text, e->length);
+		if (formula.isEmpty())
+		{
+			e->~Entry();
+			arena.release(e);
+			e = 0;
+			return;
+		}
+	}
+	else if (formula.isEmpty())
+		return;
+	else
+		e = new (arena.allocate(sizeof(Entry))) Entry;
+	
+	e->text = arena.storeText(formula);
+	e->length = formula.size();
+	e->compiled = formula.startsWith('=') ? FormulaCache::acquire(formula.mid(1), row, column) : 0;
+	e->dirty = true;
+	lookupIndex.retain(e->compiled, row, column);
+}
+
+// Empties the sheet. The arena is recycled as a whole, so the entries are
+// only destroyed, not released one by one.
+void Sheet::reset()
+{
+	for (int i = 0; i < entries.count(); ++i)
+	{
+		if (entries[i])
+		{
+			FormulaCache::release(entries[i]->compiled);
+			entries[i]->~Entry();
+			entries[i] = 0;
+		}
+	}
+	arena.clear();
+	dependencies.clear();
+	volatileCells.clear();
+	damaged.clear();
+	rangeIndex.clear();
+	lookupIndex.clear();
+	sharedValues.clear();
+	cycleRoots.clear();
+	cyclesPending = false;
+}
+
+void Sheet::updatePrecedents(int row, int column)
+{
+	int id = dependencies.id(row, column);
+	Entry* e = entry(row, column);
+	const Formula* compiled = e ? e->compiled : 0;
+	dependencies.setPrecedents(id, compiled ? compiled->precedents(row, column) : QVector<QRect>());
+	if (compiled && compiled->isVolatile())
+		volatileCells.insert(id);
+	else
+		volatileCells.remove(id);
+	rangeIndex.invalidate(row, column);
+	lookupIndex.invalidate(row, column);
+	sharedValues.clear();
+}
+
+// The cell reads as a circular reference error while its own formula is
+// being evaluated, so a cycle ends there.
+Value Sheet::evaluate(Entry* entry, int row, int column) const
+{
+	if (entry->dirty)
+	{
+		entry->dirty = false;
+		if (entry->compiled)
+		{
+			entry->value = Value::fromError(Value::CircularReference);
+			entry->value = entry->compiled->evaluate(*this, row, column);
+		}
+		else if (entry->text[0] == '\'')
+			entry->value = Value::fromString(QString(entry->text + 1, entry->length - 1));
+		else if (entry->text[0] == '=')
+			entry->value = Value::fromError(Value::SyntaxError);
+		else
+		{
+			bool ok;
+			QString str = entry->formula();
+			double d = str.toDouble(&ok);
+			entry->value = ok ? Value(d) : Value::fromString(str);
+		}
+	}
+	return entry->value;
+}
+
+// Marks a cell dirty and stale in the indexes, and remembers the value it
+// had before for takeDamage(). With iterative calculation the cell is also
+// where the next solveCycles() starts looking.
+void Sheet::markDirty(int id)
+{
+	int row = dependencies.row(id);
+	int column = dependencies.column(id);
+	Entry* e = entry(row, column);
+	if (e)
+	{
+		if (!damaged.contains(id))
+			damaged.insert(id, e->value);
+		e->dirty = true;
+	}
+	rangeIndex.invalidate(row, column);
+	lookupIndex.invalidate(row, column);
+	sharedValues.clear();
+	if (iterativeCalc && !cyclesPending)
+		cycleRoots.insert(id);
+}
+
+void Sheet::invalidateAll()
+{
+	for (int i = 0; i < entries.count(); ++i)
+	{
+		if (entries[i])
+			entries[i]->dirty = true;
+	}
+	rangeIndex.clear();
+	lookupIndex.invalidateAll();
+	sharedValues.clear();
+	volatiles.now = VolatileState::currentTime();
+	++volatiles.pass;
+	cycleRoots.clear();
+	cyclesPending = true;
+}
+
+// The cells that call NOW() or RAND() and every cell that depends on them,
+// whose values change with each recalculation.
+QSet<int> Sheet::volatileCone() const
+{
+	QVector<int> cells = volatileCells.toList().toVector();
+	QSet<int> result = volatileCells;
+	foreach (int id, dependencies.cone(cells))
+		result.insert(id);
+	return result;
+}
+
+// Circular groups cannot be evaluated lazily, so with iterative
+// calculation any that an edit dirtied are solved before a value is read.
+void Sheet::settle() const
+{
+	if (iterativeCalc && (cyclesPending || !cycleRoots.isEmpty()))
+		const_cast<Sheet*>(this)->solveCycles();
+}
+
+// Solves every circular group of formulas that has a dirty cell. A group
+// can only be solved once the cells it reads from outside are known, so
+// the groups are taken level by level: a group's level is one more than
+// that of any group it reads from, and the groups of one level are
+// solved together on the thread pool. The cells a group reads from
+// outside are evaluated here, on this thread, before it is handed over;
+// each group starts from the values its cells last had. After edits only
+// the groups that the dirtied cells reach are looked for.
+void Sheet::solveCycles()
+{
+	QVector<QVector<int> > components = cyclesPending ? dependencies.components()
+		: dependencies.components(cycleRoots.toList().toVector());
+	cyclesPending = false;
+	cycleRoots.clear();
+	QHash<int, int> componentOf;
+	for (int i = 0; i < components.count(); ++i)
+	{
+		foreach (int id, components[i])
+			componentOf.insert(id, i);
+	}
+	
+	QVector<int> levels(components.count(), 0);
+	int levelCount = 0;
+	for (int i = 0; i < components.count(); ++i)
+	{
+		levelCount = qMax(levelCount, levels[i] + 1);
+		foreach (int id, components[i])
+		{
+			foreach (int dependent, dependencies.dependents(id))
+			{
+				int j = componentOf.value(dependent, i);
+				if (j != i)
+					levels[j] = qMax(levels[j], levels[i] + 1);
+			}
+		}
+	}
+	
+	for (int level = 0; level < levelCount; ++level)
+	{
+		QVector<CycleSolver> solvers;
+		for (int i = 0; i < components.count(); ++i)
+		{
+			const QVector<int>& members = components[i];
+			if (levels[i] != level)
+				continue;
+			if (members.count() == 1 && !dependencies.dependents(members[0]).contains(members[0]))
+				continue;
+			
+			bool dirty = false;
+			foreach (int id, members)
+			{
+				Entry* e = entry(dependencies.row(id), dependencies.column(id));
+				dirty = dirty || (e && e->dirty);
+			}
+			if (!dirty)
+				continue;
+			
+			CycleSolver solver(rows, columns);
+			solver.setLimits(maxIterations, maxChange);
+			solver.setVolatileState(volatiles);
+			QVector<QRect> reads;
+			foreach (int id, members)
+			{
+				int row = dependencies.row(id);
+				int column = dependencies.column(id);
+				Entry* e = entry(row, column);
+				if (!e || !e->compiled)
+					continue;
+				solver.addCell(row, column, e->compiled, e->value);
+				reads += e->compiled->precedents(row, column);
+			}
+			foreach (QRect rect, reads)
+			{
+				rect &= QRect(0, 0, columns, rows);
+				for (int column = rect.left(); column <= rect.right(); ++column)
+				{
+					for (int row = rect.top(); row <= rect.bottom(); ++row)
+					{
+						if (entry(row, column) && componentOf.value(dependencies.id(row, column), -1) != i)
+							solver.setOutsideValue(row, column, cellValue(row, column));
+					}
+				}
+			}
+			solvers.append(solver);
+		}
+		
+		QtConcurrent::blockingMap(solvers, solveCycle);
+		
+		foreach (const CycleSolver& solver, solvers)
+		{
+			for (int j = 0; j < solver.cellCount(); ++j)
+			{
+				QPoint p = solver.cell(j);
+				Entry* e = entry(p.y(), p.x());
+				e->value = solver.value(j);
+				e->dirty = false;
+				rangeIndex.invalidate(p.y(), p.x());
+				lookupIndex.invalidate(p.y(), p.x());
+			}
+		}
+		sharedValues.clear();
+	}
+}
+
+// A formula filled down a column compiles to one shared Formula in every
+// row, so each such run is evaluated as a whole rather than cell by cell.
+void Sheet::evaluateRuns()
+{
+	QVector<Value> results;
+	
+	for (int column = 0; column < columns; ++column)
+	{
+		int row = 0;
+		while (row < rows)
+		{
+			Entry* e = entry(row, column);
+			const Formula* compiled = (e && e->dirty) ? e->compiled : 0;
+			int end = row + 1;
+			if (compiled)
+			{
+				while (end < rows && entry(end, column) && entry(end, column)->dirty
+					&& entry(end, column)->compiled == compiled)
+					++end;
+			}
+			
+			if (end - row >= MinRunLength)
+			{
+				results.resize(end - row);
+				compiled->evaluateRun(*this, row, column, end - row, results.data());
+				for (int i = row; i < end; ++i)
+				{
+					entry(i, column)->value = results[i - row];
+					entry(i, column)->dirty = false;
+				}
+			}
+			row = end;
+		}
+	}
+}
+
+// Where the stamp of a values file starts: the engine, and the settings
+// that decide what circular references evaluate to.
+uint Sheet::calculationStamp() const
+{
+	uint stamp = EngineVersion;
+	if (iterativeCalc)
+	{
+		stamp = stamp * 31 + 1;
+		stamp = stamp * 31 + uint(maxIterations);
+		stamp = stamp * 31 + qHash(QByteArray::fromRawData(reinterpret_cast<const char*>(&maxChange), sizeof(maxChange)));
+	}
+	return stamp;
+}
+
+SheetSnapshot Sheet::takeSnapshot(const QList<QPoint>& inputs) const
+{
+	SheetSnapshot result(rows, columns);
+	for (int column = 0; column < columns; ++column)
+	{
+		for (int row = 0; row < rows; ++row)
+		{
+			Entry* e = entry(row, column);
+			if (e)
+				result.setCell(row, column, evaluate(e, row, column), e->compiled);
+		}
+	}
+	
+	QVector<int> cells;
+	foreach (const QPoint& input, inputs)
+		cells.append(dependencies.id(input.y(), input.x()));
+	result.setCone(dependencies.cone(cells));
+	result.setVolatileState(volatiles);
+	return result;
+}
+
+Value Sheet::cellValue(int row, int column) const
+{
+	Value value;
+	return storedValue(row, column, &value) ? value : Value(0.0);
+}
+
+bool Sheet::storedValue(int row, int column, Value* value) const
+{
+	if (!contains(row, column))
+		return false;
+	Entry* e = entry(row, column);
+	if (e)
+		*value = evaluate(e, row, column);
+	return e != 0;
+}
+
+RangeTotals Sheet::rangeTotals(int top, int left, int bottom, int right) const
+{
+	return rangeIndex.totals(top, left, bottom, right);
+}
+
+// Column ranges go through the shared lookup tables; a range along a row
+// is short, and is searched where it lies.
+int Sheet::match(const Value& key, int top, int left, int bottom, int right, int type) const
+{
+	if (left == right)
+		return lookupIndex.match(key, top, left, bottom, type);
+	return LookupIndex::scan(this, rows, columns, key, top, left, bottom, right, type);
+}
@@ -0,0 +1,132 @@
+#ifndef SHEET_H
+#define SHEET_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QPoint>
+#include <QRect>
+#include <QSet>
+#include <QString>
+#include "cellarena.h"
+#include "dependencygraph.h"
+#include "formula.h"
+#include "lookupindex.h"
+#include "rangeindex.h"
+#include "sheetsnapshot.h"
+#include "solver.h"
+
+class QDataStream;
+
+// A sheet without a widget: the text of each cell, the values of its
+// formulas, the dependencies between them and the recalculation that keeps
+// the values current. The spreadsheet window is a view over one; programs
+// that need the engine but not the window use it directly. Every public
+// function holds the sheet's lock while it runs, so one Sheet can be shared
+// by any number of threads; the calls are serialized. Values are evaluated
+// when first asked for; with automatic recalculation an edit dirties the
+// cells that depend on it, and without it only the edited cell.
+class Sheet : private EvalContext, private ValueSource
+{
+public:
+	Sheet(int rowCount = 999, int columnCount = 26);
+	~Sheet();
+	
+	int rowCount() const { return rows; }
+	int columnCount() const { return columns; }
+	void clear();
+	void setFormula(int row, int column, const QString& formula);
+	QString formula(int row, int column) const;
+	Value value(int row, int column) const;
+	RangeTotals totals(int top, int left, int bottom, int right) const;
+	QList<QPoint> cells() const;
+	
+	bool autoRecalculate() const;
+	void setAutoRecalculate(bool recalc);
+	bool iterativeCalculation() const;
+	void setIterativeCalculation(bool iterative);
+	int iterationLimit() const;
+	double iterationTolerance() const;
+	void setIterationLimits(int maxIterations, double maxChange);
+	bool storesValues() const;
+	void setStoreValues(bool store);
+	quint64 randomSeed() const;
+	void setRandomSeed(quint64 seed);
+	
+	void recalculate();
+	void calculate();
+	void recalculateVolatiles();
+	bool hasVolatiles() const;
+	QList<QPair<QPoint, Value> > takeDamage();
+	
+	bool read(QDataStream& in);
+	void write(QDataStream& out) const;
+	
+	SheetSnapshot snapshot(const QList<QPoint>& inputs) const;
+	SolverResult goalSeek(const QPoint& target, double goal, const QPoint& input);
+	SolverResult optimize(const QPoint& target, Solver::Objective objective, const QVector<QPoint>& inputs);
+	bool fillDataTable(const QRect& table, const QPoint& rowInput, const QPoint& columnInput);
+private:
+	Sheet(const Sheet&);
+	Sheet& operator=(const Sheet&);
+	
+	enum { MagicNumber = 0x7F51C883, ValuesMagicNumber = 0x7F51C884, EngineVersion = 1,
+		MinRunLength = 8 };
+	
+	struct Entry
+	{
+		const QChar* text;
+		int length;
+		const Formula* compiled;
+		Value value;
+		bool dirty;
+		
+		QString formula() const { return QString(text, length); }
+	};
+	
+	bool contains(int row, int column) const;
+	Entry* entry(int row, int column) const { return entries[column * rows + row]; }
+	void assign(int row, int column, const QString& formula);
+	void setEntry(int row, int column, const QString& formula);
+	void reset();
+	void updatePrecedents(int row, int column);
+	Value evaluate(Entry* entry, int row, int column) const;
+	void markDirty(int id);
+	void invalidateAll();
+	QSet<int> volatileCone() const;
+	void settle() const;
+	void solveCycles();
+	void evaluateRuns();
+	uint calculationStamp() const;
+	SheetSnapshot takeSnapshot(const QList<QPoint>& inputs) const;
+	
+	Value cellValue(int row, int column) const;
+	RangeTotals rangeTotals(int top, int left, int bottom, int right) const;
+	int match(const Value& key, int top, int left, int bottom, int right, int type) const;
+	VolatileState volatileState() const { return volatiles; }
+	SharedResults* sharedResults() const { return &sharedValues; }
+	bool storedValue(int row, int column, Value* value) const;
+	
+	int rows;
+	int columns;
+	mutable QMutex mutex;
+	CellArena arena;
+	QVector<Entry*> entries;
+	DependencyGraph dependencies;
+	RangeIndex rangeIndex;
+	LookupIndex lookupIndex;
+	mutable SharedResults sharedValues;
+	VolatileState volatiles;
+	QSet<int> volatileCells;
+	QHash<int, Value> damaged;
+	QSet<int> cycleRoots;
+	bool autoRecalc;
+	bool iterativeCalc;
+	bool storeValues;
+	int maxIterations;
+	double maxChange;
+	bool cyclesPending;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include <QtCore>
+#include "sheetsnapshot.h"
+#include "lookupindex.h"
+#include "rangeindex.h"
+
+SheetSnapshot::SheetSnapshot(int rowCount, int columnCount)
+	: values(rowCount * columnCount), formulas(rowCount * columnCount, 0),
+	  present(rowCount * columnCount, false), inCone(rowCount * columnCount, false)
+{
+	this->rowCount = rowCount;
+	this->columnCount = columnCount;
+}
+
+SheetSnapshot::SheetSnapshot(const SheetSnapshot& other)
+	: rowCount(other.rowCount), columnCount(other.columnCount), values(other.values),
+	  formulas(other.formulas), present(other.present), inCone(other.inCone),
+	  volatiles(other.volatiles)
+{
+	foreach (const Formula* formula, formulas)
+		FormulaCache::retain(formula);
+}
+
+SheetSnapshot::~SheetSnapshot()
+{
+	foreach (const Formula* formula, formulas)
+		FormulaCache::release(formula);
+}
+
+// The new formulas are retained before the old ones are released, so that
+// assigning a snapshot to itself keeps them.
+SheetSnapshot& SheetSnapshot::operator=(const SheetSnapshot& other)
+{
+	foreach (const Formula* formula, other.formulas)
+		FormulaCache::retain(formula);
+	foreach (const Formula* formula, formulas)
+		FormulaCache::release(formula);
+	rowCount = other.rowCount;
+	columnCount = other.columnCount;
+	values = other.values;
+	formulas = other.formulas;
+	present = other.present;
+	inCone = other.inCone;
+	volatiles = other.volatiles;
+	return *this;
+}
+
+void SheetSnapshot::setCell(int row, int column, const Value& value, const Formula* formula)
+{
+	int i = id(row, column);
+	values[i] = value;
+	FormulaCache::retain(formula);
+	FormulaCache::release(formulas[i]);
+	formulas[i] = formula;
+	present[i] = true;
+}
+
+void SheetSnapshot::setCone(const QVector<int>& cells)
+{
+	inCone.fill(false);
+	foreach (int cell, cells)
+		inCone[cell] = true;
+}
+
+Scenario::Scenario(const SheetSnapshot* snapshot)
+	: memo(snapshot->values.count()), stamps(snapshot->values.count(), 0)
+{
+	this->snapshot = snapshot;
+	generation = 1;
+}
+
+void Scenario::setInput(const QPoint& cell, const Value& value)
+{
+	int i = inputIndex(snapshot->id(cell.y(), cell.x()));
+	if (i < 0)
+	{
+		inputIds.append(snapshot->id(cell.y(), cell.x()));
+		inputValues.append(value);
+	}
+	else
+		inputValues[i] = value;
+	++generation;
+}
+
+void Scenario::clearInputs()
+{
+	inputIds.clear();
+	inputValues.clear();
+	++generation;
+}
+
+int Scenario::inputIndex(int id) const
+{
+	for (int i = 0; i < inputIds.count(); ++i)
+	{
+		if (inputIds[i] == id)
+			return i;
+	}
+	return -1;
+}
+
+Value Scenario::cellValue(int row, int column) const
+{
+	if (row < 0 || row >= snapshot->rowCount || column < 0 || column >= snapshot->columnCount)
+		return 0.0;
+	
+	int id = snapshot->id(row, column);
+	int input = inputIndex(id);
+	if (input >= 0)
+		return inputValues[input];
+	if (!snapshot->inCone[id])
+		return snapshot->values[id];
+	if (stamps[id] == generation)
+		return memo[id];
+	
+	stamps[id] = generation;
+	memo[id] = Value::fromError(Value::CircularReference);
+	const Formula* formula = snapshot->formulas[id];
+	Value value = formula ? formula->evaluate(*this, row, column) : snapshot->values[id];
+	memo[id] = value;
+	return value;
+}
+
+// A cell holds a value if the sheet had one there or it is an input.
+bool Scenario::storedValue(int row, int column, Value* value) const
+{
+	int id = snapshot->id(row, column);
+	if (!snapshot->present[id] && inputIndex(id) < 0)
+		return false;
+	*value = cellValue(row, column);
+	return true;
+}
+
+// Ranges are read cell by cell; the range indexes belong to the sheet and
+// know nothing of the inputs.
+RangeTotals Scenario::rangeTotals(int top, int left, int bottom, int right) const
+{
+	return RangeIndex::scan(this, snapshot->rowCount, snapshot->columnCount, top, left, bottom, right);
+}
+
+int Scenario::match(const Value& key, int top, int left, int bottom, int right, int type) const
+{
+	return LookupIndex::scan(this, snapshot->rowCount, snapshot->columnCount, key, top, left, bottom, right, type);
+}
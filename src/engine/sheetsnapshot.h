@@ -0,0 +1,66 @@
+#ifndef SHEETSNAPSHOT_H
+#define SHEETSNAPSHOT_H
+
+#include <QPoint>
+#include <QVector>
+#include "formula.h"
+
+// A copy of a sheet's values and compiled formulas that holds no items, so
+// formulas can be evaluated against it from worker threads. Cells are
+// numbered column by column, as in DependencyGraph. The cone is the set of
+// cells that depend on the inputs a Scenario will change; only those are
+// ever evaluated again. The snapshot holds a reference to each formula,
+// so it stays good however the sheet is edited afterwards.
+class SheetSnapshot
+{
+public:
+	SheetSnapshot(int rowCount, int columnCount);
+	SheetSnapshot(const SheetSnapshot& other);
+	~SheetSnapshot();
+	SheetSnapshot& operator=(const SheetSnapshot& other);
+	
+	int id(int row, int column) const { return column * rowCount + row; }
+	void setCell(int row, int column, const Value& value, const Formula* formula);
+	void setCone(const QVector<int>& cells);
+	void setVolatileState(const VolatileState& state) { volatiles = state; }
+private:
+	friend class Scenario;
+	
+	int rowCount;
+	int columnCount;
+	QVector<Value> values;
+	QVector<const Formula*> formulas;
+	QVector<bool> present;
+	QVector<bool> inCone;
+	VolatileState volatiles;
+};
+
+// Evaluates a snapshot with some cells set to other values. Each cell of
+// the cone is evaluated at most once per set of inputs; every other cell
+// reads its copied value. A scenario is meant for one thread; the snapshot
+// can be shared by any number of them, and must outlive it.
+class Scenario : public EvalContext, private ValueSource
+{
+public:
+	explicit Scenario(const SheetSnapshot* snapshot);
+	
+	void setInput(const QPoint& cell, const Value& value);
+	void clearInputs();
+	
+	Value cellValue(int row, int column) const;
+	RangeTotals rangeTotals(int top, int left, int bottom, int right) const;
+	int match(const Value& key, int top, int left, int bottom, int right, int type) const;
+	VolatileState volatileState() const { return snapshot->volatiles; }
+private:
+	int inputIndex(int id) const;
+	bool storedValue(int row, int column, Value* value) const;
+	
+	const SheetSnapshot* snapshot;
+	QVector<int> inputIds;
+	QVector<Value> inputValues;
+	mutable QVector<Value> memo;
+	mutable QVector<int> stamps;
+	int generation;
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include <QtCore>
+#include <limits>
+#include "solver.h"
+#include "sheetsnapshot.h"
+
+namespace
+{
+	// The target as a function of one input; false where it is not a number.
+	bool evaluate(Scenario* scenario, const QPoint& input, double x, const QPoint& target,
+		double goal, double* fx)
+	{
+		scenario->setInput(input, x);
+		Value value = scenario->cellValue(target.y(), target.x());
+		*fx = value.toNumber() - goal;
+		return value.isNumber() && qIsFinite(*fx);
+	}
+	
+	double objectiveValue(Scenario* scenario, const QVector<QPoint>& inputs, const QVector<double>& x,
+		const QPoint& target, Solver::Objective objective)
+	{
+		for (int i = 0; i < inputs.count(); ++i)
+			scenario->setInput(inputs[i], x[i]);
+		Value value = scenario->cellValue(target.y(), target.x());
+		if (!value.isNumber() || !qIsFinite(value.toNumber()))
+			return std::numeric_limits<double>::infinity();
+		return (objective == Solver::Minimize) ? value.toNumber() : -value.toNumber();
+	}
+}
+
+// Secant steps from start until the target changes sign across two
+// points, then Brent's method inside that bracket, which cannot diverge.
+SolverResult Solver::goalSeek(Scenario* scenario, const QPoint& input, double start,
+	const QPoint& target, double goal, int maxIterations)
+{
+	const double Tolerance = 1e-9 * qMax(1.0, qAbs(goal));
+	SolverResult result;
+	
+	double a = start;
+	double b = start + qMax(qAbs(start) * 0.01, 0.01);
+	double fa, fb;
+	if (!evaluate(scenario, input, a, target, goal, &fa) || !evaluate(scenario, input, b, target, goal, &fb))
+		return result;
+	result.iterations = 2;
+	
+	while (fa * fb > 0.0)
+	{
+		if (result.iterations >= maxIterations)
+			return result;
+		if (qAbs(fb) <= Tolerance)
+			break;
+		
+		double next = (fb != fa) ? b - fb * (b - a) / (fb - fa) : b + 2.0 * (b - a);
+		if (!qIsFinite(next))
+			return result;
+		double fnext;
+		if (!evaluate(scenario, input, next, target, goal, &fnext))
+			return result;
+		++result.iterations;
+		a = b;
+		fa = fb;
+		b = next;
+		fb = fnext;
+	}
+	
+	if (qAbs(fa) < qAbs(fb))
+	{
+		qSwap(a, b);
+		qSwap(fa, fb);
+	}
+	double c = a;
+	double fc = fa;
+	double d = a;
+	bool bisected = true;
+	while (qAbs(fb) > Tolerance && qAbs(b - a) > 1e-15 * qMax(1.0, qAbs(b)))
+	{
+		if (result.iterations >= maxIterations)
+			return result;
+		
+		double s;
+		if (fa != fc && fb != fc)
+			s = a * fb * fc / ((fa - fb) * (fa - fc)) + b * fa * fc / ((fb - fa) * (fb - fc))
+				+ c * fa * fb / ((fc - fa) * (fc - fb));
+		else
+			s = b - fb * (b - a) / (fb - fa);
+		
+		double bound = (3.0 * a + b) / 4.0;
+		if (!((s > qMin(bound, b) && s < qMax(bound, b)))
+			|| (bisected && qAbs(s - b) >= qAbs(b - c) / 2.0)
+			|| (!bisected && qAbs(s - b) >= qAbs(c - d) / 2.0))
+		{
+			s = (a + b) / 2.0;
+			bisected = true;
+		}
+		else
+			bisected = false;
+		
+		double fs;
+		if (!evaluate(scenario, input, s, target, goal, &fs))
+			return result;
+		++result.iterations;
+		d = c;
+		c = b;
+		fc = fb;
+		if (fa * fs < 0.0)
+		{
+			b = s;
+			fb = fs;
+		}
+		else
+		{
+			a = s;
+			fa = fs;
+		}
+		if (qAbs(fa) < qAbs(fb))
+		{
+			qSwap(a, b);
+			qSwap(fa, fb);
+		}
+	}
+	
+	result.converged = qAbs(fb) <= Tolerance || fb == 0.0 || qAbs(b - a) <= 1e-15 * qMax(1.0, qAbs(b));
+	result.inputs.append(b);
+	result.value = fb + goal;
+	scenario->setInput(input, b);
+	return result;
+}
+
+// Nelder-Mead: needs no derivatives, only the target's value at the
+// corners of a simplex that moves and shrinks towards an optimum.
+SolverResult Solver::optimize(Scenario* scenario, const QVector<QPoint>& inputs,
+	const QVector<double>& start, const QPoint& target, Objective objective, int maxIterations)
+{
+	const int n = inputs.count();
+	SolverResult result;
+	
+	QVector<QVector<double> > points(n + 1, start);
+	QVector<double> values(n + 1);
+	for (int i = 0; i < n; ++i)
+		points[i + 1][i] += (start[i] != 0.0) ? 0.05 * start[i] : 0.1;
+	for (int i = 0; i <= n; ++i)
+		values[i] = objectiveValue(scenario, inputs, points[i], target, objective);
+	result.iterations = n + 1;
+	
+	QVector<double> centroid(n);
+	QVector<double> trial(n);
+	while (result.iterations < maxIterations)
+	{
+		int best = 0;
+		int worst = 0;
+		for (int i = 1; i <= n; ++i)
+		{
+			if (values[i] < values[best])
+				best = i;
+			if (values[i] > values[worst])
+				worst = i;
+		}
+		int second = best;
+		for (int i = 0; i <= n; ++i)
+		{
+			if (i != worst && values[i] > values[second])
+				second = i;
+		}
+		
+		double spread = qAbs(values[worst] - values[best]);
+		if (spread <= 1e-12 * (qAbs(values[best]) + 1e-12))
+		{
+			result.converged = qIsFinite(values[best]);
+			break;
+		}
+		
+		centroid.fill(0.0);
+		for (int i = 0; i <= n; ++i)
+		{
+			if (i == worst)
+				continue;
+			for (int j = 0; j < n; ++j)
+				centroid[j] += points[i][j] / n;
+		}
+		
+		for (int j = 0; j < n; ++j)
+			trial[j] = centroid[j] + (centroid[j] - points[worst][j]);
+		double reflected = objectiveValue(scenario, inputs, trial, target, objective);
+		++result.iterations;
+		
+		if (reflected < values[best])
+		{
+			QVector<double> expanded(n);
+			for (int j = 0; j < n; ++j)
+				expanded[j] = centroid[j] + 2.0 * (centroid[j] - points[worst][j]);
+			double value = objectiveValue(scenario, inputs, expanded, target, objective);
+			++result.iterations;
+			if (value < reflected)
+			{
+				points[worst] = expanded;
+				values[worst] = value;
+			}
+			else
+			{
+				points[worst] = trial;
+				values[worst] = reflected;
+			}
+		}
+		else if (reflected < values[second])
+		{
+			points[worst] = trial;
+			values[worst] = reflected;
+		}
+		else
+		{
+			for (int j = 0; j < n; ++j)
+				trial[j] = centroid[j] + 0.5 * (points[worst][j] - centroid[j]);
+			double contracted = objectiveValue(scenario, inputs, trial, target, objective);
+			++result.iterations;
+			if (contracted < values[worst])
+			{
+				points[worst] = trial;
+				values[worst] = contracted;
+			}
+			else
+			{
+				for (int i = 0; i <= n; ++i)
+				{
+					if (i == best)
+						continue;
+					for (int j = 0; j < n; ++j)
+						points[i][j] = points[best][j] + 0.5 * (points[i][j] - points[best][j]);
+					values[i] = objectiveValue(scenario, inputs, points[i], target, objective);
+					++result.iterations;
+				}
+			}
+		}
+	}
+	
+	int best = 0;
+	for (int i = 1; i <= n; ++i)
+	{
+		if (values[i] < values[best])
+			best = i;
+	}
+	result.inputs = points[best];
+	result.value = (objective == Minimize) ? values[best] : -values[best];
+	objectiveValue(scenario, inputs, points[best], target, objective);
+	return result;
+}
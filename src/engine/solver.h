@@ -0,0 +1,34 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <QPoint>
+#include <QVector>
+
+class Scenario;
+
+struct SolverResult
+{
+	SolverResult() : converged(false), iterations(0), value(0.0) {}
+	
+	bool converged;
+	int iterations;
+	QVector<double> inputs;
+	double value;
+};
+
+// Numeric searches over the inputs of a Scenario. Each step sets the
+// inputs and reads the target cell, so only the cells between them are
+// evaluated again.
+class Solver
+{
+public:
+	enum Objective { Minimize, Maximize };
+	
+	static SolverResult goalSeek(Scenario* scenario, const QPoint& input, double start,
+		const QPoint& target, double goal, int maxIterations = 100);
+	static SolverResult optimize(Scenario* scenario, const QVector<QPoint>& inputs,
+		const QVector<double>& start, const QPoint& target, Objective objective,
+		int maxIterations = 2000);
+};
+
+#endif
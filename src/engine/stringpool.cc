@@ -0,0 +1,112 @@
+#include <QtCore>
+#include "stringpool.h"
+
+namespace
+{
+	// Counts live in chunks that never move, so retain() and release()
+	// need no lock unless a string dies.
+	enum { ChunkBits = 12, ChunkSize = 1 << ChunkBits, ChunkCount = 16384 };
+	
+	struct Pool
+	{
+		Pool()
+		{
+			for (int i = 0; i < ChunkCount; ++i)
+				counts[i] = 0;
+		}
+		
+		~Pool()
+		{
+			for (int i = 0; i < ChunkCount; ++i)
+				delete [] counts[i];
+		}
+		
+		QAtomicInt& count(int handle)
+		{
+			return counts[handle >> ChunkBits][handle & (ChunkSize - 1)];
+		}
+		
+		QReadWriteLock lock;
+		QHash<QString, int> handles;
+		QVector<QString> strings;
+		QBitArray live;
+		QVector<int> freeHandles;
+		QAtomicInt* counts[ChunkCount];
+	};
+}
+
+Q_GLOBAL_STATIC(Pool, pool)
+
+int StringPool::intern(const QString& str)
+{
+	Pool* p = pool();
+	{
+		QReadLocker locker(&p->lock);
+		QHash<QString, int>::const_iterator i = p->handles.constFind(str);
+		if (i != p->handles.constEnd())
+		{
+			p->count(i.value()).ref();
+			return i.value();
+		}
+	}
+	
+	QWriteLocker locker(&p->lock);
+	QHash<QString, int>::const_iterator i = p->handles.constFind(str);
+	if (i != p->handles.constEnd())
+	{
+		p->count(i.value()).ref();
+		return i.value();
+	}
+	
+	int handle;
+	if (p->freeHandles.isEmpty())
+	{
+		handle = p->strings.count();
+		Q_ASSERT(handle < ChunkCount * ChunkSize);
+		if ((handle & (ChunkSize - 1)) == 0)
+			p->counts[handle >> ChunkBits] = new QAtomicInt[ChunkSize];
+		p->strings.append(str);
+		p->live.resize(handle + 1);
+	}
+	else
+	{
+		handle = p->freeHandles.last();
+		p->freeHandles.pop_back();
+		p->strings[handle] = str;
+	}
+	p->live.setBit(handle);
+	p->count(handle) = 1;
+	p->handles.insert(str, handle);
+	return handle;
+}
+
+QString StringPool::string(int handle)
+{
+	Pool* p = pool();
+	QReadLocker locker(&p->lock);
+	return p->strings.at(handle);
+}
+
+void StringPool::retain(int handle)
+{
+	Pool* p = pool();
+	if (p)
+		p->count(handle).ref();
+}
+
+// intern() may have revived the string, or another release() removed it,
+// between the count reaching zero and the lock being taken.
+void StringPool::release(int handle)
+{
+	Pool* p = pool();
+	if (!p || p->count(handle).deref())
+		return;
+	
+	QWriteLocker locker(&p->lock);
+	if (p->count(handle) != 0 || !p->live.testBit(handle))
+		return;
+	p->handles.remove(p->strings.at(handle));
+	p->strings[handle] = QString();
+	p->live.clearBit(handle);
+	p->freeHandles.append(handle);
+}
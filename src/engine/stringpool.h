@@ -0,0 +1,20 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <QString>
+
+// Interns the strings that cells evaluate to, so a Value can refer to one
+// by an integer handle. Each handle is reference counted by the Values
+// that hold it: intern() takes a reference, and a string whose last
+// reference is released leaves the pool and its handle is reused. May be
+// used from any thread.
+class StringPool
+{
+public:
+	static int intern(const QString& str);
+	static QString string(int handle);
+	static void retain(int handle);
+	static void release(int handle);
+};
+
+#endif
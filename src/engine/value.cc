@@ -0,0 +1,126 @@
+#include <QtCore>
+#include <float.h>
+#include "value.h"
+#include "stringpool.h"
+
+Value Value::fromString(const QString& str)
+{
+	Value v;
+	v.valueType = String;
+	v.handle = StringPool::intern(str);
+	return v;
+}
+
+Value Value::fromError(ErrorCode code)
+{
+	Value v;
+	v.valueType = Error;
+	v.code = code;
+	return v;
+}
+
+// Numbers are formatted as QVariant formats doubles, so cells look the
+// same as when they held variants.
+QString Value::toString() const
+{
+	switch (valueType)
+	{
+	case Number:
+		return QString::number(number, 'g', DBL_DIG);
+	case String:
+		return StringPool::string(handle);
+	default:
+		return QString();
+	}
+}
+
+QVariant Value::toVariant() const
+{
+	switch (valueType)
+	{
+	case Number:
+		return number;
+	case String:
+		return StringPool::string(handle);
+	default:
+		return QVariant();
+	}
+}
+
+// The order lookups use: numbers before strings before errors, strings
+// compared without regard to case.
+int Value::compare(const Value& other) const
+{
+	if (valueType != other.valueType)
+		return valueType < other.valueType ? -1 : 1;
+	switch (valueType)
+	{
+	case Number:
+		return (number < other.number) ? -1 : (number > other.number) ? 1 : 0;
+	case String:
+		if (handle == other.handle)
+			return 0;
+		return StringPool::string(handle).compare(StringPool::string(other.handle), Qt::CaseInsensitive);
+	default:
+		return code - other.code;
+	}
+}
+
+bool Value::operator==(const Value& other) const
+{
+	if (valueType != other.valueType)
+		return false;
+	switch (valueType)
+	{
+	case Number:
+		return number == other.number;
+	case String:
+		return handle == other.handle;
+	default:
+		return code == other.code;
+	}
+}
+
+// A string is written as its text, since pool handles only mean something
+// within one run of the program.
+QDataStream& operator<<(QDataStream& out, const Value& value)
+{
+	out << quint8(value.type());
+	switch (value.type())
+	{
+	case Value::Number:
+		out << value.toNumber();
+		break;
+	case Value::String:
+		out << value.toString();
+		break;
+	default:
+		out << quint8(value.errorCode());
+	}
+	return out;
+}
+
+QDataStream& operator>>(QDataStream& in, Value& value)
+{
+	quint8 type;
+	in >> type;
+	if (type == Value::Number)
+	{
+		double d;
+		in >> d;
+		value = d;
+	}
+	else if (type == Value::String)
+	{
+		QString str;
+		in >> str;
+		value = Value::fromString(str);
+	}
+	else
+	{
+		quint8 code;
+		in >> code;
+		value = Value::fromError(Value::ErrorCode(code));
+	}
+	return in;
+}
@@ -0,0 +1,72 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <QString>
+#include <QVariant>
+#include "stringpool.h"
+
+class QDataStream;
+
+// What a cell or sub-expression evaluates to: a number, a string from the
+// StringPool or an error code. It is a 16-byte value, so evaluation never
+// allocates for intermediates; copying a string only touches its count in
+// the pool. QVariant only appears at the edge, in toVariant().
+class Value
+{
+public:
+	enum Type { Number, String, Error };
+	enum ErrorCode { SyntaxError = 1, DivisionByZero, TypeMismatch, CircularReference, NotAvailable, InvalidReference };
+	
+	Value() : valueType(Number), number(0.0) {}
+	Value(double d) : valueType(Number), number(d) {}
+	Value(const Value& other) : valueType(other.valueType), number(other.number)
+	{
+		if (valueType == String)
+			StringPool::retain(handle);
+	}
+	~Value()
+	{
+		if (valueType == String)
+			StringPool::release(handle);
+	}
+	Value& operator=(const Value& other)
+	{
+		if (other.valueType == String)
+			StringPool::retain(other.handle);
+		if (valueType == String)
+			StringPool::release(handle);
+		valueType = other.valueType;
+		number = other.number;
+		return *this;
+	}
+	static Value fromString(const QString& str);
+	static Value fromError(ErrorCode code);
+	
+	Type type() const { return Type(valueType); }
+	bool isNumber() const { return valueType == Number; }
+	bool isString() const { return valueType == String; }
+	bool isError() const { return valueType == Error; }
+	
+	double toNumber() const { return valueType == Number ? number : 0.0; }
+	int stringHandle() const { return valueType == String ? handle : -1; }
+	ErrorCode errorCode() const { return valueType == Error ? ErrorCode(code) : ErrorCode(0); }
+	QString toString() const;
+	QVariant toVariant() const;
+	
+	int compare(const Value& other) const;
+	bool operator==(const Value& other) const;
+	bool operator!=(const Value& other) const { return !(*this == other); }
+private:
+	int valueType;
+	union
+	{
+		double number;
+		int handle;
+		int code;
+	};
+};
+
+QDataStream& operator<<(QDataStream& out, const Value& value);
+QDataStream& operator>>(QDataStream& in, Value& value);
+
+#endif
@@ -1,193 +1,109 @@
 #include <QtGui>
 #include "cell.h"
+#include "../engine/cellarena.h"
+#include "../engine/sheet.h"
 
-Cell::Cell()
-{
-	setDirty();
-}
+// Each cell is preceded by the arena it came from, or 0 for the heap, so
+// that the plain delete QTableWidget uses finds its way back.
+static const size_t HeaderSize = 16;
 
-QTableWidgetItem* Cell::clone() const
+void* Cell::operator new(size_t size)
 {
-	return new Cell(*this);
+	char* p = static_cast<char*>(::operator new(size + HeaderSize));
+	*reinterpret_cast<CellArena**>(p) = 0;
+	return p + HeaderSize;
 }
 
-void Cell::setDirty()
+void* Cell::operator new(size_t size, CellArena* arena)
 {
-	cacheIsDirty = true;
+	char* p = static_cast<char*>(arena->allocate(size + HeaderSize));
+	*reinterpret_cast<CellArena**>(p) = arena;
+	return p + HeaderSize;
 }
 
-QString Cell::formula() const
+void Cell::operator delete(void* p)
 {
-	return data(Qt::EditRole).toString();
+	if (!p)
+		return;
+	char* block = static_cast<char*>(p) - HeaderSize;
+	CellArena* arena = *reinterpret_cast<CellArena**>(block);
+	if (arena)
+		arena->release(block);
+	else
+		::operator delete(block);
 }
 
-void Cell::setFormula(const QString& formula)
+void Cell::operator delete(void* p, CellArena*)
 {
-	setData(Qt::EditRole, formula);
+	Cell::operator delete(p);
 }
 
-void Cell::setData(int role, const QVariant& value)
+Cell::Cell(CellArena* arena, Sheet* sheet)
 {
-	QTableWidgetItem::setData(role, value);
-	if (Qt::EditRole == role)
-		setDirty();
+	this->arena = arena;
+	this->sheet = sheet;
 }
 
-QVariant Cell::data(int role) const
+Cell::Cell(const Cell& other)
+	: QTableWidgetItem(other)
 {
-	if (Qt::DisplayRole == role)
-	{
-		return value().isValid() ? value().toString() : "####";
-	}
-	else if (Qt::TextAlignmentRole == role)
-	{
-		return value().type() == QVariant::String ?
-			int(Qt::AlignLeft | Qt::AlignVCenter) : 
-			int(Qt::AlignRight | Qt::AlignVCenter);
-	}
-	else
-		return QTableWidgetItem::data(role);
+	arena = other.arena;
+	sheet = other.sheet;
+	pending = other.pending;
 }
 
-const QVariant Invalid;
-
-QVariant Cell::value() const
+QTableWidgetItem* Cell::clone() const
 {
-	if (cacheIsDirty)
-	{
-		cacheIsDirty = false;
-		QString formulaStr = formula();
-		if (formulaStr.startsWith('\''))
-			cachedValue = formulaStr.mid(1);
-		else if (formulaStr.startsWith('='))
-		{
-			cachedValue = Invalid;
-			QString expr = formulaStr.mid(1);
-			expr.replace(" ", "");
-			expr.append(QChar::Null);
-			
-			int pos = 0;
-			cachedValue = evalExpression(expr, pos);
-			if (expr[pos] != QChar::Null)
-				cachedValue = Invalid;
-		}
-		else
-		{
-			bool ok;
-			double d = formulaStr.toDouble(&ok);
-			cachedValue = ok ? QVariant(d) : formulaStr;
-		}
-	}
-	return cachedValue;
+	return new (arena) Cell(*this);
 }
 
-QVariant Cell::evalExpression(const QString& str, int& pos) const
+// Returns the text of an edit made before the item was placed, and forgets it.
+QString Cell::takePendingFormula()
 {
-	QVariant result = evalTerm(str, pos);
-	while (str[pos] != QChar::Null)
-	{
-		QChar op = str[pos];
-		if (op != '+' && op != '-')
-			return result;
-		++pos;
-		
-		QVariant term = evalTerm(str, pos);
-		if (result.type() == QVariant::Double && term.type() == QVariant::Double)
-		{
-			if (op == '+')
-				result = result.toDouble() + term.toDouble();
-			else
-				result = result.toDouble() - term.toDouble();
-		}
-		else
-			result = Invalid;
-	}
-	return result;
+	QString formula = pending;
+	pending.clear();
+	return formula;
 }
 
-QVariant Cell::evalTerm(const QString& str, int& pos) const
+// An edit goes straight to the sheet. The sheet dirties what depends on
+// the cell; the view recalculates once it hears of the change.
+void Cell::setData(int role, const QVariant& value)
 {
-	QVariant result = evalFactor(str, pos);
-	while (str[pos] != QChar::Null)
+	if (Qt::EditRole == role || Qt::DisplayRole == role)
 	{
-		QChar op = str[pos];
-		if (op != '*' && op != '/')
-			return result;
-		++pos;
-		
-		QVariant factor = evalFactor(str, pos);
-		if (result.type() == QVariant::Double && factor.type() == QVariant::Double)
+		if (!tableWidget())
 		{
-			if (op == '*')
-				result = result.toDouble() * factor.toDouble();
-			else
-			{
-				if (factor.toDouble() == 0.0)
-					result = Invalid;
-				else
-					result = result.toDouble() / factor.toDouble();
-			}
+			pending = value.toString();
+			return;
 		}
-		else
-			result = Invalid;
+		sheet->setFormula(row(), column(), value.toString());
+		
+		// QTableWidgetItem has no other public way to report a change.
+		setFlags(flags());
 	}
-	return result;
+	else
+		QTableWidgetItem::setData(role, value);
 }
 
-QVariant Cell::evalFactor(const QString& str, int& pos) const
+QVariant Cell::data(int role) const
 {
-	QVariant result;
-	bool negative = false;
-	
-	if (str[pos] == '-')
+	if (!tableWidget() && (Qt::DisplayRole == role || Qt::EditRole == role))
+		return pending;
+	if (Qt::DisplayRole == role)
 	{
-		negative = true;
-		++pos;
+		if (sheet->formula(row(), column()).isEmpty())
+			return QString();
+		Value v = sheet->value(row(), column());
+		return v.isError() ? QString("####") : v.toString();
 	}
-	
-	if (str[pos] == '(')
+	else if (Qt::EditRole == role)
+		return sheet->formula(row(), column());
+	else if (Qt::TextAlignmentRole == role)
 	{
-		++pos;
-		result = evalExpression(str, pos);
-		if (str[pos] != ')')
-			result = Invalid;
-		++pos;
+		return sheet->value(row(), column()).isString() ?
+			int(Qt::AlignLeft | Qt::AlignVCenter) : 
+			int(Qt::AlignRight | Qt::AlignVCenter);
 	}
 	else
-	{
-		QRegExp regExp("[A-Za-z][1-9][0-9]{0,2}");
-		QString token;
-		while (str[pos].isLetterOrNumber() || str[pos] == '.')
-		{
-			token += str[pos];
-			++pos;
-		}
-		if (regExp.exactMatch(token))
-		{
-			int column = token[0].toUpper().unicode() - 'A';
-			int row = token.mid(1).toInt() - 1;
-			
-			Cell* c = static_cast<Cell*>(tableWidget()->item(row, column));
-			if (c)
-				result = c->value();
-			else
-				result = 0.0;
-		}
-		else
-		{
-			bool ok;
-			result = token.toDouble(&ok);
-			if (!ok)
-				result = Invalid;
-		}
-	}
-	
-	if (negative)
-	{
-		if (result.type() == QVariant::Double)
-			result = -result.toDouble();
-		else
-			result = Invalid;
-	}
-	return result;
+		return QTableWidgetItem::data(role);
 }
\ No newline at end of file
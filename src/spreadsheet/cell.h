@@ -3,24 +3,33 @@
 
 #include <QTableWidgetItem>
 
+class CellArena;
+class Sheet;
+
+// An item of the spreadsheet view. The text and value of a cell live in
+// the Sheet; the item only shows them and hands edits back. An item that
+// is edited before it is in a table, as QTableWidget does for a new
+// cell, keeps the text until the view takes it.
 class Cell : public QTableWidgetItem
 {
 public:
-	Cell();
+	Cell(CellArena* arena, Sheet* sheet);
+	Cell(const Cell& other);
 	QTableWidgetItem* clone() const;
 	void setData(int role, const QVariant& value);
 	QVariant data(int role) const;
-	void setFormula(const QString& formula);
-	QString formula() const;
-	void setDirty();
+	QString takePendingFormula();
+	
+	void* operator new(size_t size);
+	void* operator new(size_t size, CellArena* arena);
+	void operator delete(void* p);
+	void operator delete(void* p, CellArena* arena);
 private:
-	QVariant value() const;
-	QVariant evalExpression(const QString& str, int& pos) const;
-	QVariant evalTerm(const QString& str, int& pos) const;
-	QVariant evalFactor(const QString& str, int& pos) const;
+	Cell& operator=(const Cell&);
 	
-	mutable QVariant cachedValue;
-	mutable bool cacheIsDirty;
+	CellArena* arena;
+	Sheet* sheet;
+	QString pending;
 };
 
 #endif
\ No newline at end of file
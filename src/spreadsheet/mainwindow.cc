@@ -132,6 +132,133 @@ void MainWindow::sort()
 	*/
 }
 
+void MainWindow::dataTable()
+{
+	QPoint rowInput(-1, -1);
+	QPoint columnInput(-1, -1);
+	if (askForCell(tr("Data Table"), tr("Row input cell (values along the top row), or empty:"), &rowInput)
+		&& askForCell(tr("Data Table"), tr("Column input cell (values down the left column), or empty:"), &columnInput))
+		spreadsheet->fillDataTable(rowInput, columnInput);
+}
+
+void MainWindow::goalSeek()
+{
+	QPoint target(-1, -1);
+	QPoint input(-1, -1);
+	if (!askForCell(tr("Goal Seek"), tr("Set cell:"), &target) || target.x() < 0)
+		return;
+	bool ok;
+	double goal = QInputDialog::getDouble(this, tr("Goal Seek"), tr("To value:"), 0.0,
+		-1e12, 1e12, 6, &ok);
+	if (!ok || !askForCell(tr("Goal Seek"), tr("By changing cell:"), &input) || input.x() < 0)
+		return;
+	
+	SolverResult result = spreadsheet->goalSeek(target, goal, input);
+	if (result.converged)
+		statusBar()->showMessage(tr("Goal seek found a solution in %1 steps").arg(result.iterations), 2000);
+}
+
+void MainWindow::solve()
+{
+	QPoint target(-1, -1);
+	if (!askForCell(tr("Solver"), tr("Target cell:"), &target) || target.x() < 0)
+		return;
+	
+	QStringList objectives;
+	objectives << tr("Minimize") << tr("Maximize");
+	bool ok;
+	QString objective = QInputDialog::getItem(this, tr("Solver"), tr("Objective:"), objectives, 0, false, &ok);
+	if (!ok)
+		return;
+	
+	QString str = QInputDialog::getText(this, tr("Solver"), tr("By changing cells (such as B1, B2):"),
+		QLineEdit::Normal, QString(), &ok).toUpper();
+	if (!ok)
+		return;
+	QRegExp regExp("[A-Z][1-9][0-9]{0,2}");
+	QVector<QPoint> inputs;
+	foreach (QString location, str.split(QRegExp("[,; ]+"), QString::SkipEmptyParts))
+	{
+		if (!regExp.exactMatch(location))
+		{
+			QApplication::beep();
+			return;
+		}
+		inputs.append(QPoint(location[0].unicode() - 'A', location.mid(1).toInt() - 1));
+	}
+	if (inputs.isEmpty())
+		return;
+	
+	SolverResult result = spreadsheet->optimize(target,
+		objective == objectives[0] ? Solver::Minimize : Solver::Maximize, inputs);
+	if (result.converged)
+		statusBar()->showMessage(tr("Solver converged in %1 steps").arg(result.iterations), 2000);
+}
+
+// Iterative calculation stops a circular group after the given number of
+// passes, or sooner once no cell changes by more than the tolerance.
+void MainWindow::chooseIterationLimits()
+{
+	bool ok;
+	int maxIterations = QInputDialog::getInt(this, tr("Iteration Limits"),
+		tr("Maximum iterations:"), spreadsheet->iterationLimit(), 1, 32767, 1, &ok);
+	if (!ok)
+		return;
+	double maxChange = QInputDialog::getDouble(this, tr("Iteration Limits"),
+		tr("Maximum change:"), spreadsheet->iterationTolerance(), 0.000001, 1e6, 6, &ok);
+	if (!ok)
+		return;
+	spreadsheet->setIterationLimits(maxIterations, maxChange);
+}
+
+// With a fixed seed RAND() draws the same numbers every time the program
+// starts; with none it is seeded from the clock.
+void MainWindow::chooseRandomSeed()
+{
+	bool ok;
+	QString str = QInputDialog::getText(this, tr("Random Seed"),
+		tr("Seed for RAND(), or empty for a new seed each run:"), QLineEdit::Normal,
+		fixedSeed ? QString::number(spreadsheet->randomSeed()) : QString(), &ok).trimmed();
+	if (!ok)
+		return;
+	if (str.isEmpty())
+	{
+		fixedSeed = false;
+		return;
+	}
+	quint64 seed = str.toULongLong(&ok);
+	if (!ok)
+	{
+		QApplication::beep();
+		return;
+	}
+	fixedSeed = true;
+	spreadsheet->setRandomSeed(seed);
+}
+
+// Asks for a cell location such as "B3"; an empty answer leaves cell as it
+// is. Returns false if the user cancels.
+bool MainWindow::askForCell(const QString& title, const QString& label, QPoint* cell)
+{
+	QRegExp regExp("[A-Za-z][1-9][0-9]{0,2}");
+	for (;;)
+	{
+		bool ok;
+		QString str = QInputDialog::getText(this, title, label,
+			QLineEdit::Normal, QString(), &ok).trimmed().toUpper();
+		if (!ok)
+			return false;
+		if (str.isEmpty())
+			return true;
+		if (regExp.exactMatch(str))
+		{
+			*cell = QPoint(str[0].unicode() - 'A', str.mid(1).toInt() - 1);
+			return true;
+		}
+		QApplication::beep();
+	}
+}
+
 void MainWindow::about()
 {
 	QMessageBox::about(this, tr("About Spreadsheet"), 
@@ -146,6 +273,40 @@ void MainWindow::updateStatusBar()
 {
 	locationLabel->setText(spreadsheet->currentLocation());
 	formulaLabel->setText(spreadsheet->currentFormula());
+	statsTimer->start();
+}
+
+// Runs once per pass of the event loop however often the selection
+// changed; the totals come from the sheet's range index, so only
+// cells changed since the last query are read again.
+void MainWindow::updateSelectionStats()
+{
+	QTableWidgetSelectionRange range = spreadsheet->selectedRange();
+	if (range.rowCount() * range.columnCount() <= 1)
+	{
+		statsLabel->clear();
+		return;
+	}
+	
+	RangeTotals totals = spreadsheet->sheet()->totals(range.topRow(), range.leftColumn(),
+		range.bottomRow(), range.rightColumn());
+	if (totals.error.isError())
+	{
+		statsLabel->setText(tr("Count: %1").arg(totals.count));
+		return;
+	}
+	
+	QString text = tr("Sum: %1  Count: %2")
+		.arg(Value(totals.sum).toString())
+		.arg(totals.count);
+	if (totals.count > 0)
+	{
+		text += tr("  Average: %1  Min: %2  Max: %3")
+			.arg(Value(totals.sum / totals.count).toString())
+			.arg(Value(totals.min).toString())
+			.arg(Value(totals.max).toString());
+	}
+	statsLabel->setText(text);
 }
 
 void MainWindow::spreadsheetModified()
@@ -247,6 +408,18 @@ void MainWindow::createActions()
 	sortAction->setStatusTip(tr("Sort cells by contents"));
 	connect(sortAction, SIGNAL(triggered()), this, SLOT(sort()));
 	
+	dataTableAction = new QAction(tr("&Data Table..."), this);
+	dataTableAction->setStatusTip(tr("Fill the selection with the results of a formula for every combination of input values"));
+	connect(dataTableAction, SIGNAL(triggered()), this, SLOT(dataTable()));
+	
+	goalSeekAction = new QAction(tr("&Goal Seek..."), this);
+	goalSeekAction->setStatusTip(tr("Find the input value that makes a formula reach a given value"));
+	connect(goalSeekAction, SIGNAL(triggered()), this, SLOT(goalSeek()));
+	
+	solverAction = new QAction(tr("S&olver..."), this);
+	solverAction->setStatusTip(tr("Find the input values that minimize or maximize a formula"));
+	connect(solverAction, SIGNAL(triggered()), this, SLOT(solve()));
+	
 	showGridAction = new QAction(tr("&Show Grid"), this);
 	showGridAction->setCheckable(true);
 	showGridAction->setChecked(spreadsheet->showGrid());
@@ -259,6 +432,26 @@ void MainWindow::createActions()
 	autoRecalcAction->setStatusTip(tr("Toggle auto-recalculate"));
 	connect(autoRecalcAction, SIGNAL(toggled(bool)), spreadsheet, SLOT(setAutoRecalculate(bool)));
 	
+	iterativeCalcAction = new QAction(tr("&Iterative Calculation"), this);
+	iterativeCalcAction->setCheckable(true);
+	iterativeCalcAction->setChecked(spreadsheet->iterativeCalculation());
+	iterativeCalcAction->setStatusTip(tr("Solve circular references by iteration"));
+	connect(iterativeCalcAction, SIGNAL(toggled(bool)), spreadsheet, SLOT(setIterativeCalculation(bool)));
+	
+	iterationLimitsAction = new QAction(tr("Iteration &Limits..."), this);
+	iterationLimitsAction->setStatusTip(tr("Set how long iterative calculation works on a circular reference"));
+	connect(iterationLimitsAction, SIGNAL(triggered()), this, SLOT(chooseIterationLimits()));
+	
+	saveValuesAction = new QAction(tr("Save Calculated &Values"), this);
+	saveValuesAction->setCheckable(true);
+	saveValuesAction->setChecked(spreadsheet->storesValues());
+	saveValuesAction->setStatusTip(tr("Store calculated values in saved files so they open without recalculating"));
+	connect(saveValuesAction, SIGNAL(toggled(bool)), spreadsheet, SLOT(setStoreValues(bool)));
+	
+	randomSeedAction = new QAction(tr("Random S&eed..."), this);
+	randomSeedAction->setStatusTip(tr("Fix the seed of RAND() so that it draws the same numbers every run"));
+	connect(randomSeedAction, SIGNAL(triggered()), this, SLOT(chooseRandomSeed()));
+	
 	aboutAction = new QAction(tr("&About"), this);
 	aboutAction->setStatusTip(tr("Show this application's About box"));
 	connect(aboutAction, SIGNAL(triggered()), this, SLOT(about()));
@@ -299,10 +492,17 @@ void MainWindow::createMenus()
 	toolsMenu = menuBar()->addMenu(tr("&Tools"));
 	toolsMenu->addAction(recalculateAction);
 	toolsMenu->addAction(sortAction);
+	toolsMenu->addAction(dataTableAction);
+	toolsMenu->addAction(goalSeekAction);
+	toolsMenu->addAction(solverAction);
 	
 	optionsMenu = menuBar()->addMenu(tr("&Options"));
 	optionsMenu->addAction(showGridAction);
 	optionsMenu->addAction(autoRecalcAction);
+	optionsMenu->addAction(iterativeCalcAction);
+	optionsMenu->addAction(iterationLimitsAction);
+	optionsMenu->addAction(saveValuesAction);
+	optionsMenu->addAction(randomSeedAction);
 	
 	menuBar()->addSeparator();
 	
@@ -344,10 +544,20 @@ void MainWindow::createStatusBar()
 	formulaLabel = new QLabel;
 	formulaLabel->setIndent(3);
 	
+	statsLabel = new QLabel;
+	statsLabel->setIndent(3);
+	
 	statusBar()->addWidget(locationLabel);
 	statusBar()->addWidget(formulaLabel, 1);
+	statusBar()->addPermanentWidget(statsLabel);
+	
+	statsTimer = new QTimer(this);
+	statsTimer->setSingleShot(true);
+	statsTimer->setInterval(0);
 	
+	connect(statsTimer, SIGNAL(timeout()), this, SLOT(updateSelectionStats()));
 	connect(spreadsheet, SIGNAL(currentCellChanged(int,int,int,int)), this, SLOT(updateStatusBar()));
+	connect(spreadsheet, SIGNAL(itemSelectionChanged()), statsTimer, SLOT(start()));
 	connect(spreadsheet, SIGNAL(modified()), this, SLOT(spreadsheetModified()));
 	
 	updateStatusBar();
@@ -363,6 +573,17 @@ void MainWindow::readSettings()
 	showGridAction->setChecked(showGrid);
 	bool autoRecalc = settings.value("autoRecalc", true).toBool();
 	autoRecalcAction->setChecked(autoRecalc);
+	int maxIterations = settings.value("maxIterations", 100).toInt();
+	double maxChange = settings.value("maxChange", 0.001).toDouble();
+	spreadsheet->setIterationLimits(maxIterations, maxChange);
+	fixedSeed = settings.contains("randomSeed");
+	if (fixedSeed)
+		spreadsheet->setRandomSeed(settings.value("randomSeed").toULongLong());
+	spreadsheet->setVolatileInterval(settings.value("volatileInterval", 0).toInt());
+	bool iterativeCalc = settings.value("iterativeCalc", false).toBool();
+	iterativeCalcAction->setChecked(iterativeCalc);
+	bool saveValues = settings.value("saveValues", true).toBool();
+	saveValuesAction->setChecked(saveValues);
 }
 
 void MainWindow::writeSettings()
@@ -372,6 +593,15 @@ void MainWindow::writeSettings()
 	settings.setValue("recentFiles", recentFiles);
 	settings.setValue("showGrid", showGridAction->isChecked());
 	settings.setValue("autoRecalc", autoRecalcAction->isChecked());
+	settings.setValue("iterativeCalc", iterativeCalcAction->isChecked());
+	settings.setValue("saveValues", saveValuesAction->isChecked());
+	settings.setValue("maxIterations", spreadsheet->iterationLimit());
+	settings.setValue("maxChange", spreadsheet->iterationTolerance());
+	settings.setValue("volatileInterval", spreadsheet->volatileInterval());
+	if (fixedSeed)
+		settings.setValue("randomSeed", spreadsheet->randomSeed());
+	else
+		settings.remove("randomSeed");
 }
 
 void MainWindow::closeEvent(QCloseEvent* event)
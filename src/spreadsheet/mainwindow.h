@@ -5,6 +5,7 @@
 
 class QAction;
 class QLabel;
+class QTimer;
 class FindDialog;
 class Spreadsheet;
 
@@ -23,9 +24,15 @@ private slots:
 	void find();
 	void goToCell();
 	void sort();
+	void dataTable();
+	void goalSeek();
+	void solve();
+	void chooseIterationLimits();
+	void chooseRandomSeed();
 	void about();
 	void openRecentFile();
 	void updateStatusBar();
+	void updateSelectionStats();
 	void spreadsheetModified();
 private:
 	void createActions();
@@ -36,6 +43,7 @@ private:
 	void readSettings();
 	void writeSettings();
 	bool okToContinue();
+	bool askForCell(const QString& title, const QString& label, QPoint* cell);
 	bool loadFile(const QString& fileName);
 	bool saveFile(const QString& fileName);
 	void setCurrentFile(const QString& fileName);
@@ -46,8 +54,11 @@ private:
 	FindDialog* findDialog;
 	QLabel* locationLabel;
 	QLabel* formulaLabel;
+	QLabel* statsLabel;
+	QTimer* statsTimer;
 	QStringList recentFiles;
 	QString curFile;
+	bool fixedSeed;
 	
 	enum { MaxRecentFiles = 5 };
 	QAction* recentFileActions[MaxRecentFiles];
@@ -79,8 +90,15 @@ private:
 	QAction* goToCellAction;
 	QAction* recalculateAction;
 	QAction* sortAction;
+	QAction* dataTableAction;
+	QAction* goalSeekAction;
+	QAction* solverAction;
 	QAction* showGridAction;
 	QAction* autoRecalcAction;
+	QAction* iterativeCalcAction;
+	QAction* iterationLimitsAction;
+	QAction* saveValuesAction;
+	QAction* randomSeedAction;
 	QAction* aboutAction;
 	QAction* aboutQtAction;
 };
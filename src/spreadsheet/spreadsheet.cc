@@ -6,15 +6,26 @@
 Spreadsheet::Spreadsheet(QWidget* parent)
 	: QTableWidget(parent)
 {
-	autoRecalc = true;
+	engine = new Sheet(RowCount, ColumnCount);
+	volatilesPending = false;
+	repaintPending = false;
+	volatileTimer = new QTimer(this);
+	connect(volatileTimer, SIGNAL(timeout()), this, SLOT(recalculateVolatiles()));
 	
-	setItemPrototype(new Cell);
+	setItemPrototype(new Cell(&arena, engine));
 	setSelectionMode(ContiguousSelection);
 	
-	connect(this, SIGNAL(itemChanged(QTableWidgetItem*)), this, SLOT(somethingChanged()));
+	connect(this, SIGNAL(itemChanged(QTableWidgetItem*)), this, SLOT(itemEdited(QTableWidgetItem*)));
 	clear();
 }
 
+Spreadsheet::~Spreadsheet()
+{
+	// The cells must go while the arena they live in is still there.
+	setRowCount(0);
+	delete engine;
+}
+
 void Spreadsheet::cut()
 {
 	copy();
@@ -77,8 +88,13 @@ void Spreadsheet::del()
 	QList<QTableWidgetItem*> items = selectedItems();
 	if (!items.isEmpty())
 	{	
+		QList<QPoint> cells;
+		foreach (QTableWidgetItem* item, items)
+			cells.append(QPoint(column(item), row(item)));
 		foreach (QTableWidgetItem* item, items)
 			delete item;
+		foreach (const QPoint& pos, cells)
+			engine->setFormula(pos.y(), pos.x(), QString());
 		somethingChanged();
 	}
 }
@@ -95,22 +111,87 @@ void Spreadsheet::selectCurrentColumn()
 
 void Spreadsheet::recalculate()
 {
-	for (int row = 0; row < RowCount; ++row)
-	{
-		for (int column = 0; column < ColumnCount; ++column)
-		{
-			if (cell(row, column))
-				cell(row, column)->setDirty();
-		}
-	}
+	engine->recalculate();
+	engine->takeDamage();
+	viewport()->update();
+}
+
+// Shows the sheet after a change of settings: what is dirty is brought up
+// to date and every visible cell is painted again.
+void Spreadsheet::refresh()
+{
+	engine->calculate();
+	engine->takeDamage();
 	viewport()->update();
 }
 
 void Spreadsheet::setAutoRecalculate(bool recalc)
 {
-	autoRecalc = recalc;
-	if (autoRecalc)
-		recalculate();
+	engine->setAutoRecalculate(recalc);
+	if (recalc)
+		refresh();
+}
+
+void Spreadsheet::setIterativeCalculation(bool iterative)
+{
+	engine->setIterativeCalculation(iterative);
+	refresh();
+}
+
+// Volatile passes run on the timer, if it is set, and once after each
+// round of edits.
+void Spreadsheet::recalculateVolatiles()
+{
+	volatilesPending = false;
+	if (!engine->autoRecalculate() || !engine->hasVolatiles())
+		return;
+	
+	engine->recalculateVolatiles();
+	engine->calculate();
+	scheduleRepaint();
+}
+
+// Edits made in one go, such as reading a file, share one volatile pass.
+void Spreadsheet::scheduleVolatiles()
+{
+	if (!volatilesPending && engine->hasVolatiles())
+	{
+		volatilesPending = true;
+		QTimer::singleShot(0, this, SLOT(recalculateVolatiles()));
+	}
+}
+
+void Spreadsheet::setRandomSeed(quint64 seed)
+{
+	engine->setRandomSeed(seed);
+	if (engine->autoRecalculate())
+		refresh();
+}
+
+int Spreadsheet::volatileInterval() const
+{
+	return volatileTimer->isActive() ? volatileTimer->interval() : 0;
+}
+
+// An interval of 0 stops the timer.
+void Spreadsheet::setVolatileInterval(int msec)
+{
+	if (msec > 0)
+		volatileTimer->start(msec);
+	else
+		volatileTimer->stop();
+}
+
+void Spreadsheet::setStoreValues(bool store)
+{
+	engine->setStoreValues(store);
+}
+
+void Spreadsheet::setIterationLimits(int maxIterations, double maxChange)
+{
+	engine->setIterationLimits(maxIterations, maxChange);
+	if (engine->iterativeCalculation())
+		refresh();
 }
 
 void Spreadsheet::findNext(const QString& str, Qt::CaseSensitivity cs)
@@ -163,11 +244,61 @@ void Spreadsheet::findPrevious(const QString& str, Qt::CaseSensitivity cs)
 
 void Spreadsheet::somethingChanged()
 {
-	if (autoRecalc)
-		recalculate();
+	if (engine->autoRecalculate())
+	{
+		engine->calculate();
+		scheduleRepaint();
+		scheduleVolatiles();
+	}
 	emit modified();
 }
 
+// An edit to a cell that had no item arrives on the new item before it is
+// placed; any other edit has already gone to the sheet.
+void Spreadsheet::itemEdited(QTableWidgetItem* item)
+{
+	QString pending = static_cast<Cell*>(item)->takePendingFormula();
+	if (!pending.isEmpty())
+		engine->setFormula(row(item), column(item), pending);
+	somethingChanged();
+}
+
+void Spreadsheet::scheduleRepaint()
+{
+	if (!repaintPending)
+	{
+		repaintPending = true;
+		QTimer::singleShot(0, this, SLOT(repaintDamage()));
+	}
+}
+
+// Repaints the visible cells whose values changed since they were marked
+// dirty, once for all the changes made before control returns to the
+// event loop. Cells out of view are left dirty; they are evaluated when
+// they are next painted.
+void Spreadsheet::repaintDamage()
+{
+	typedef QPair<QPoint, Value> Damage;
+	
+	repaintPending = false;
+	QRect visible = viewport()->rect();
+	QRegion region;
+	
+	foreach (const Damage& damage, engine->takeDamage())
+	{
+		int row = damage.first.y();
+		int column = damage.first.x();
+		QRect rect = visualRect(model()->index(row, column));
+		if (!rect.intersects(visible))
+			continue;
+		if (engine->value(row, column) != damage.second)
+			region += rect;
+	}
+	
+	if (!region.isEmpty())
+		viewport()->update(region);
+}
+
 QString Spreadsheet::currentLocation() const
 {
 	return QChar('A' + currentColumn()) + QString::number(currentRow() + 1);
@@ -179,9 +310,17 @@ QString Spreadsheet::currentFormula() const
 }
 
 void Spreadsheet::clear()
+{
+	engine->clear();
+	createItems();
+}
+
+// Replaces the items with one for each cell the sheet holds.
+void Spreadsheet::createItems()
 {
 	setRowCount(0);
 	setColumnCount(0);
+	arena.clear();
 	setRowCount(RowCount);
 	setColumnCount(ColumnCount);
 	
@@ -191,6 +330,11 @@ void Spreadsheet::clear()
 		item->setText(QString(QChar('A' + i)));
 		setHorizontalHeaderItem(i, item);
 	}
+	
+	blockSignals(true);
+	foreach (const QPoint& pos, engine->cells())
+		setItem(pos.y(), pos.x(), new (&arena) Cell(&arena, engine));
+	blockSignals(false);
 	setCurrentCell(0, 0);
 }
 
@@ -209,25 +353,20 @@ bool Spreadsheet::readFile(const QString& fileName)
 	QDataStream in(&file);
 	in.setVersion(QDataStream::Qt_4_7);
 	
-	quint32 magic;
-	in >> magic;
-	if (magic != MagicNumber)
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	if (!engine->read(in))
 	{
+		QApplication::restoreOverrideCursor();
 		QMessageBox::warning(this, tr("Spreadsheet"), tr("The file is not a Spreadsheet file."));
 		return false;
 	}
-	
-	clear();
-	
-	quint16 row, column;
-	QString str;
-	
-	QApplication::setOverrideCursor(Qt::WaitCursor);
-	while (!in.atEnd())
+	createItems();
+	if (engine->autoRecalculate())
 	{
-		in >> row >> column >> str;
-		setFormula(row, column, str);
+		engine->calculate();
+		scheduleVolatiles();
 	}
+	viewport()->update();
 	QApplication::restoreOverrideCursor();
 	return true;
 }
@@ -247,20 +386,64 @@ bool Spreadsheet::writeFile(const QString& fileName)
 	QDataStream out(&file);
 	out.setVersion(QDataStream::Qt_4_7);
 	
-	out << quint32(MagicNumber);
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	engine->write(out);
+	QApplication::restoreOverrideCursor();
+	return true;
+}
+
+// Fills the selected range as a what-if table; see Sheet::fillDataTable().
+bool Spreadsheet::fillDataTable(const QPoint& rowInput, const QPoint& columnInput)
+{
+	QTableWidgetSelectionRange range = selectedRange();
+	QRect table(range.leftColumn(), range.topRow(), range.columnCount(), range.rowCount());
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	bool filled = engine->fillDataTable(table, rowInput, columnInput);
+	QApplication::restoreOverrideCursor();
+	if (!filled)
+	{
+		QMessageBox::information(this, tr("Spreadsheet"),
+			tr("Select the table, with its input values along the top row and left column, and give at least one input cell."));
+		return false;
+	}
 	
+	for (int row = range.topRow() + 1; row <= range.bottomRow(); ++row)
+	{
+		for (int column = range.leftColumn() + 1; column <= range.rightColumn(); ++column)
+			updateCell(row, column);
+	}
+	somethingChanged();
+	return true;
+}
+
+SolverResult Spreadsheet::goalSeek(const QPoint& target, double goal, const QPoint& input)
+{
 	QApplication::setOverrideCursor(Qt::WaitCursor);
-	for (int row = 0; row < RowCount; ++row)
+	SolverResult result = engine->goalSeek(target, goal, input);
+	QApplication::restoreOverrideCursor();
+	
+	if (result.converged)
 	{
-		for (int column = 0; column < ColumnCount; ++column)
-		{
-			QString str = formula(row, column);
-			if (!str.isEmpty())
-				out << quint16(row) << quint16(column) << str;
-		}
+		updateCell(input.y(), input.x());
+		somethingChanged();
 	}
+	else
+		QMessageBox::information(this, tr("Spreadsheet"), tr("Goal seek did not find a solution."));
+	return result;
+}
+
+SolverResult Spreadsheet::optimize(const QPoint& target, Solver::Objective objective, const QVector<QPoint>& inputs)
+{
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	SolverResult result = engine->optimize(target, objective, inputs);
 	QApplication::restoreOverrideCursor();
-	return true;
+	
+	foreach (const QPoint& input, inputs)
+		updateCell(input.y(), input.x());
+	somethingChanged();
+	if (!result.converged)
+		QMessageBox::information(this, tr("Spreadsheet"), tr("The solver stopped before it converged."));
+	return result;
 }
 
 QTableWidgetSelectionRange Spreadsheet::selectedRange() const
@@ -284,26 +467,34 @@ QString Spreadsheet::text(int row, int column) const
 
 QString Spreadsheet::formula(int row, int column) const
 {
-	Cell* c = cell(row, column);
-	return c ? c->formula() : "";
+	return engine->formula(row, column);
 }
 
 void Spreadsheet::setFormula(int row, int column, const QString& formula)
 {
-	Cell* c = cell(row, column);
-	if (!c)
-	{	
-		c = new Cell;
-		setItem(row, column, c);
+	engine->setFormula(row, column, formula);
+	updateCell(row, column);
+}
+
+// Gives a cell the sheet holds something for an item, or repaints the
+// item it has. Placing an item is not an edit, so it is not reported.
+void Spreadsheet::updateCell(int row, int column)
+{
+	if (cell(row, column))
+		update(model()->index(row, column));
+	else if (!engine->formula(row, column).isEmpty())
+	{
+		bool blocked = blockSignals(true);
+		setItem(row, column, new (&arena) Cell(&arena, engine));
+		blockSignals(blocked);
 	}
-	c->setFormula(formula);
 }
 
 void Spreadsheet::sort(const SpreadsheetCompare& compare)
 {
 	QList<QStringList> rows;
 	QTableWidgetSelectionRange range = selectedRange();
-		
+	
 	for (int i = 0; i < range.rowCount(); ++i)
 	{
 		QStringList row;
@@ -2,16 +2,33 @@
 #define SPREADSHEET_H_
 
 #include <QTableWidget>
+#include "../engine/cellarena.h"
+#include "../engine/sheet.h"
 
 class Cell;
+class QTimer;
 class SpreadsheetCompare;
 
+// A view over a Sheet. The sheet holds the cells and recalculates them;
+// the items only show them, and this class turns edits, files and tools
+// into calls on the sheet and repaints what changed.
 class Spreadsheet : public QTableWidget
 {
 	Q_OBJECT
 public:
 	Spreadsheet(QWidget* parent = 0);
-	bool autoRecalculate() const { return autoRecalc; }
+	~Spreadsheet();
+	Sheet* sheet() const { return engine; }
+	bool autoRecalculate() const { return engine->autoRecalculate(); }
+	bool iterativeCalculation() const { return engine->iterativeCalculation(); }
+	bool storesValues() const { return engine->storesValues(); }
+	int iterationLimit() const { return engine->iterationLimit(); }
+	double iterationTolerance() const { return engine->iterationTolerance(); }
+	void setIterationLimits(int maxIterations, double maxChange);
+	quint64 randomSeed() const { return engine->randomSeed(); }
+	void setRandomSeed(quint64 seed);
+	int volatileInterval() const;
+	void setVolatileInterval(int msec);
 	QString currentLocation() const;
 	QString currentFormula() const;
 	QTableWidgetSelectionRange selectedRange() const;
@@ -19,6 +36,9 @@ public:
 	bool readFile(const QString& fileName);
 	bool writeFile(const QString& fileName);
 	void sort(const SpreadsheetCompare& compare);
+	bool fillDataTable(const QPoint& rowInput, const QPoint& columnInput);
+	SolverResult goalSeek(const QPoint& target, double goal, const QPoint& input);
+	SolverResult optimize(const QPoint& target, Solver::Objective objective, const QVector<QPoint>& inputs);
 public slots:
 	void cut();
 	void copy();
@@ -28,20 +48,34 @@ public slots:
 	void selectCurrentColumn();
 	void recalculate();
 	void setAutoRecalculate(bool recalc);
+	void setIterativeCalculation(bool iterative);
+	void setStoreValues(bool store);
+	void recalculateVolatiles();
 	void findNext(const QString& str, Qt::CaseSensitivity cs);
 	void findPrevious(const QString& str, Qt::CaseSensitivity cs);
 signals:
 	void modified();
 private slots:
 	void somethingChanged();
+	void itemEdited(QTableWidgetItem* item);
+	void repaintDamage();
 private:
-	enum { MagicNumber = 0x7F51C883, RowCount = 999, ColumnCount = 26 };
+	enum { RowCount = 999, ColumnCount = 26 };
 	Cell* cell(int row, int column) const;
 	QString text(int row, int column) const;
 	QString formula(int row, int column) const;
 	void setFormula(int row, int column, const QString& formula);
+	void updateCell(int row, int column);
+	void createItems();
+	void refresh();
+	void scheduleVolatiles();
+	void scheduleRepaint();
 	
-	bool autoRecalc;
+	CellArena arena;
+	Sheet* engine;
+	QTimer* volatileTimer;
+	bool volatilesPending;
+	bool repaintPending;
 };
 
 class SpreadsheetCompare
@@ -0,0 +1,77 @@
+#include <QtTest>
+#include <limits>
+#include "rangeindextest.h"
+#include "../engine/rangeindex.h"
+
+namespace
+{
+	// One column of cells that the tests set directly.
+	class Cells : public ValueSource
+	{
+	public:
+		bool storedValue(int row, int column, Value* value) const
+		{
+			if (column != 0 || !values.contains(row))
+				return false;
+			*value = values.value(row);
+			return true;
+		}
+		
+		void set(RangeIndex& index, int row, double value)
+		{
+			values.insert(row, value);
+			index.invalidate(row, 0);
+		}
+		
+		QMap<int, Value> values;
+	};
+	
+	double sum(const RangeIndex& index, int top, int bottom)
+	{
+		return index.totals(top, 0, bottom, 0).result(RangeTotals::Sum).toNumber();
+	}
+}
+
+void RangeIndexTest::overwrittenLargeValue()
+{
+	Cells cells;
+	RangeIndex index(&cells, 16, 1);
+	cells.set(index, 0, 1e20);
+	cells.set(index, 1, 1.0);
+	QCOMPARE(sum(index, 0, 1), 1e20);
+	
+	cells.set(index, 0, 0.0);
+	QCOMPARE(sum(index, 0, 1), 1.0);
+	QCOMPARE(index.totals(0, 0, 1, 0).result(RangeTotals::Average).toNumber(), 0.5);
+}
+
+void RangeIndexTest::overwrittenInfinity()
+{
+	Cells cells;
+	RangeIndex index(&cells, 16, 1);
+	cells.set(index, 0, std::numeric_limits<double>::infinity());
+	cells.set(index, 1, 1.0);
+	QVERIFY(qIsInf(sum(index, 0, 1)));
+	
+	cells.set(index, 0, 5.0);
+	QCOMPARE(sum(index, 0, 1), 6.0);
+	
+	cells.set(index, 0, std::numeric_limits<double>::quiet_NaN());
+	QVERIFY(qIsNaN(sum(index, 0, 1)));
+	
+	cells.set(index, 0, 5.0);
+	QCOMPARE(sum(index, 0, 1), 6.0);
+}
+
+void RangeIndexTest::rangeBesideLargeValue()
+{
+	Cells cells;
+	RangeIndex index(&cells, 16, 1);
+	cells.set(index, 0, 1e20);
+	cells.set(index, 1, 1.0);
+	cells.set(index, 2, std::numeric_limits<double>::infinity());
+	QCOMPARE(sum(index, 1, 1), 1.0);
+	QCOMPARE(sum(index, 0, 1), 1e20);
+}
+
+QTEST_APPLESS_MAIN(RangeIndexTest)
@@ -0,0 +1,15 @@
+#ifndef RANGEINDEXTEST_H
+#define RANGEINDEXTEST_H
+
+#include <QObject>
+
+class RangeIndexTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void overwrittenLargeValue();
+	void overwrittenInfinity();
+	void rangeBesideLargeValue();
+};
+
+#endif
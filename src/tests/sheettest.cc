@@ -0,0 +1,228 @@
+#include <QtTest>
+#include "sheettest.h"
+#include "../engine/sheet.h"
+
+namespace
+{
+	double number(const Sheet& sheet, int row, int column)
+	{
+		return sheet.value(row, column).toNumber();
+	}
+}
+
+void SheetTest::sumFollowsEdits()
+{
+	Sheet sheet(16, 4);
+	sheet.setFormula(0, 0, "1");
+	sheet.setFormula(1, 0, "2");
+	sheet.setFormula(2, 0, "=SUM(A1:A2)");
+	sheet.setFormula(0, 1, "=A3*10");
+	QCOMPARE(number(sheet, 2, 0), 3.0);
+	QCOMPARE(number(sheet, 0, 1), 30.0);
+	
+	sheet.setFormula(0, 0, "5");
+	sheet.calculate();
+	QCOMPARE(number(sheet, 2, 0), 7.0);
+	QCOMPARE(number(sheet, 0, 1), 70.0);
+	
+	sheet.setFormula(1, 0, QString());
+	QCOMPARE(number(sheet, 2, 0), 5.0);
+	QCOMPARE(sheet.cells().count(), 3);
+}
+
+// The spaces are dropped before the references are read, so "=A1 2" reads
+// A12 and shares its compiled form with "=A2 2" only as far as that reads
+// A22.
+void SheetTest::spacesInReferences()
+{
+	Sheet sheet(32, 4);
+	sheet.setFormula(11, 0, "12");
+	sheet.setFormula(12, 0, "13");
+	sheet.setFormula(21, 0, "22");
+	sheet.setFormula(0, 1, "=A1 2");
+	sheet.setFormula(1, 1, "=A2 2");
+	sheet.setFormula(2, 1, "=A 1");
+	QCOMPARE(number(sheet, 0, 1), 12.0);
+	QCOMPARE(number(sheet, 1, 1), 22.0);
+	QCOMPARE(number(sheet, 2, 1), 0.0);
+	
+	sheet.setFormula(0, 0, "1");
+	QCOMPARE(number(sheet, 2, 1), 1.0);
+}
+
+// The table behind a MATCH is dropped with the last formula searching its
+// range and built again for the next one.
+void SheetTest::lookupFollowsEdits()
+{
+	Sheet sheet(16, 4);
+	for (int row = 0; row < 4; ++row)
+		sheet.setFormula(row, 0, QString::number(10 * (row + 1)));
+	sheet.setFormula(0, 1, "=MATCH(30,A1:A4,0)");
+	QCOMPARE(number(sheet, 0, 1), 3.0);
+	
+	sheet.setFormula(1, 0, "30");
+	QCOMPARE(number(sheet, 0, 1), 2.0);
+	
+	sheet.setFormula(0, 1, QString());
+	sheet.setFormula(1, 1, "=MATCH(40,A1:A4,0)");
+	QCOMPARE(number(sheet, 1, 1), 4.0);
+	
+	sheet.setFormula(3, 0, "5");
+	QVERIFY(sheet.value(1, 1).isError());
+	sheet.setFormula(0, 0, "40");
+	QCOMPARE(number(sheet, 1, 1), 1.0);
+}
+
+void SheetTest::manualRecalculation()
+{
+	Sheet sheet(16, 4);
+	sheet.setAutoRecalculate(false);
+	sheet.setFormula(0, 0, "1");
+	sheet.setFormula(1, 0, "=A1+1");
+	QCOMPARE(number(sheet, 1, 0), 2.0);
+	
+	sheet.setFormula(0, 0, "4");
+	QCOMPARE(number(sheet, 1, 0), 2.0);
+	sheet.recalculate();
+	QCOMPARE(number(sheet, 1, 0), 5.0);
+}
+
+void SheetTest::iterativeCycle()
+{
+	Sheet sheet(16, 4);
+	sheet.setFormula(0, 0, "=B1/2+1");
+	sheet.setFormula(0, 1, "=A1");
+	QVERIFY(sheet.value(0, 0).isError());
+	
+	sheet.setIterativeCalculation(true);
+	sheet.setIterationLimits(1000, 1e-12);
+	QVERIFY(qAbs(number(sheet, 0, 0) - 2.0) < 1e-9);
+	QVERIFY(qAbs(number(sheet, 0, 1) - 2.0) < 1e-9);
+	
+	// An edit solves the cycles it reaches again; the others keep their values.
+	sheet.setFormula(1, 0, "=B2/2+3");
+	sheet.setFormula(1, 1, "=A2");
+	sheet.setFormula(2, 2, "4");
+	sheet.setFormula(0, 0, "=B1/2+C3");
+	QVERIFY(qAbs(number(sheet, 0, 0) - 8.0) < 1e-9);
+	QVERIFY(qAbs(number(sheet, 1, 0) - 6.0) < 1e-9);
+	sheet.setFormula(2, 2, "1");
+	QVERIFY(qAbs(number(sheet, 0, 1) - 2.0) < 1e-9);
+	QVERIFY(qAbs(number(sheet, 1, 1) - 6.0) < 1e-9);
+}
+
+void SheetTest::goalSeek()
+{
+	Sheet sheet(16, 4);
+	sheet.setFormula(0, 0, "2");
+	sheet.setFormula(0, 1, "=A1*A1");
+	SolverResult result = sheet.goalSeek(QPoint(1, 0), 9.0, QPoint(0, 0));
+	QVERIFY(result.converged);
+	QVERIFY(qAbs(number(sheet, 0, 1) - 9.0) < 1e-6);
+	QCOMPARE(number(sheet, 0, 0), result.inputs.first());
+}
+
+// A snapshot keeps the formulas it copied after the sheet lets them go,
+// and gives them back when it is destroyed.
+void SheetTest::snapshotOutlivesEdits()
+{
+	int formulaCount = FormulaCache::count();
+	{
+		Sheet sheet(16, 4);
+		sheet.setFormula(0, 0, "2");
+		sheet.setFormula(0, 1, "=A1*3");
+		SheetSnapshot base = sheet.snapshot(QList<QPoint>() << QPoint(0, 0));
+		sheet.clear();
+		
+		Scenario scenario(&base);
+		scenario.setInput(QPoint(0, 0), Value(5.0));
+		QCOMPARE(scenario.cellValue(0, 1).toNumber(), 15.0);
+	}
+	QCOMPARE(FormulaCache::count(), formulaCount);
+}
+
+// A one-input table: the output formula heads the second column and the
+// input values run down the first.
+void SheetTest::dataTable()
+{
+	Sheet sheet(16, 8);
+	sheet.setFormula(0, 0, "1");
+	sheet.setFormula(0, 4, "=A1*10");
+	sheet.setFormula(1, 3, "2");
+	sheet.setFormula(2, 3, "3");
+	QVERIFY(!sheet.fillDataTable(QRect(3, 0, 2, 3), QPoint(-1, -1), QPoint(-1, -1)));
+	QVERIFY(sheet.fillDataTable(QRect(3, 0, 2, 3), QPoint(-1, -1), QPoint(0, 0)));
+	QCOMPARE(number(sheet, 1, 4), 20.0);
+	QCOMPARE(number(sheet, 2, 4), 30.0);
+	QCOMPARE(number(sheet, 0, 4), 10.0);
+	QCOMPARE(sheet.formula(1, 4), QString("20"));
+	
+	sheet.setFormula(0, 5, "=10/A1");
+	sheet.setFormula(3, 3, "0");
+	QVERIFY(sheet.fillDataTable(QRect(3, 0, 3, 4), QPoint(-1, -1), QPoint(0, 0)));
+	QCOMPARE(number(sheet, 1, 5), 5.0);
+	QCOMPARE(sheet.value(3, 5).errorCode(), Value::DivisionByZero);
+	QCOMPARE(sheet.formula(3, 5), QString("=#DIV/0!"));
+}
+
+void SheetTest::writeAndRead()
+{
+	Sheet sheet(16, 4);
+	sheet.setFormula(0, 0, "1");
+	sheet.setFormula(1, 0, "2");
+	sheet.setFormula(2, 0, "=SUM(A1:A2)");
+	sheet.setFormula(0, 1, "'text");
+	
+	QByteArray bytes;
+	QDataStream out(&bytes, QIODevice::WriteOnly);
+	sheet.write(out);
+	
+	Sheet copy(16, 4);
+	copy.setFormula(3, 3, "9");
+	QDataStream in(bytes);
+	QVERIFY(copy.read(in));
+	QCOMPARE(copy.cells(), sheet.cells());
+	QCOMPARE(copy.formula(2, 0), QString("=SUM(A1:A2)"));
+	QCOMPARE(number(copy, 2, 0), 3.0);
+	QCOMPARE(copy.value(0, 1).toString(), QString("text"));
+	
+	copy.setFormula(0, 0, "10");
+	QCOMPARE(number(copy, 2, 0), 12.0);
+}
+
+// A cell that reads RAND() is not saved with its value, so after reading it
+// agrees with the draw the reading sheet makes.
+void SheetTest::readRecalculatesVolatiles()
+{
+	Sheet sheet(16, 4);
+	sheet.setRandomSeed(1);
+	sheet.setFormula(0, 0, "=RAND()");
+	sheet.setFormula(0, 1, "=A1*2");
+	sheet.setFormula(0, 2, "=B1+1");
+	sheet.setFormula(1, 0, "=3*4");
+	
+	QByteArray bytes;
+	QDataStream out(&bytes, QIODevice::WriteOnly);
+	sheet.write(out);
+	
+	Sheet copy(16, 4);
+	copy.setRandomSeed(2);
+	QDataStream in(bytes);
+	QVERIFY(copy.read(in));
+	QVERIFY(number(copy, 0, 0) != number(sheet, 0, 0));
+	QCOMPARE(number(copy, 0, 1), 2 * number(copy, 0, 0));
+	QCOMPARE(number(copy, 0, 2), number(copy, 0, 1) + 1);
+	QCOMPARE(number(copy, 1, 0), 12.0);
+}
+
+void SheetTest::readRejectsOtherFiles()
+{
+	Sheet sheet(16, 4);
+	sheet.setFormula(0, 0, "1");
+	QByteArray bytes("not a spreadsheet");
+	QDataStream in(bytes);
+	QVERIFY(!sheet.read(in));
+	QCOMPARE(sheet.formula(0, 0), QString("1"));
+}
+
+QTEST_APPLESS_MAIN(SheetTest)
@@ -0,0 +1,23 @@
+#ifndef SHEETTEST_H
+#define SHEETTEST_H
+
+#include <QObject>
+
+class SheetTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void sumFollowsEdits();
+	void spacesInReferences();
+	void lookupFollowsEdits();
+	void manualRecalculation();
+	void iterativeCycle();
+	void goalSeek();
+	void snapshotOutlivesEdits();
+	void dataTable();
+	void writeAndRead();
+	void readRecalculatesVolatiles();
+	void readRejectsOtherFiles();
+};
+
+#endif